@@ -1,6 +1,7 @@
 HEADERS = \
     source/fb2html.h \
     source/fb2app.hpp \
+    source/fb2cache.h \
     source/fb2code.hpp \
     source/fb2dlgs.hpp \
     source/fb2dock.hpp \
@@ -10,18 +11,25 @@ HEADERS = \
     source/fb2main.hpp \
     source/fb2note.hpp \
     source/fb2page.hpp \
+    source/fb2piece.hpp \
     source/fb2read.hpp \
     source/fb2tree.hpp \
     source/fb2save.hpp \
+    source/fb2srch.hpp \
+    source/fb2stat.hpp \
+    source/fb2sync.hpp \
     source/fb2text.hpp \
     source/fb2utils.h \
+    source/fb2valid.hpp \
     source/fb2xml.hpp \
+    source/fb2xsd.hpp \
     source/fb2mode.h \
     source/fb2xml2.h \
     source/fb2logs.hpp
 
 SOURCES = \
     source/fb2app.cpp \
+    source/fb2cache.cpp \
     source/fb2code.cpp \
     source/fb2dlgs.cpp \
     source/fb2dock.cpp \
@@ -32,13 +40,19 @@ SOURCES = \
     source/fb2main.cpp \
     source/fb2note.cpp \
     source/fb2page.cpp \
+    source/fb2piece.cpp \
     source/fb2read.cpp \
     source/fb2save.cpp \
+    source/fb2srch.cpp \
+    source/fb2stat.cpp \
+    source/fb2sync.cpp \
     source/fb2tree.cpp \
     source/fb2xml.cpp \
     source/fb2xml2.cpp \
+    source/fb2xsd.cpp \
     source/fb2text.cpp \
     source/fb2utils.cpp \
+    source/fb2valid.cpp \
     source/fb2mode.cpp \
     source/fb2logs.cpp
 
@@ -70,6 +84,13 @@ OTHER_FILES += \
     source/js/section_get.js \
     source/js/section_new.js \
     source/js/location.js \
+    source/js/node_id.js \
+    source/js/text_index.js \
+    source/js/sync_map.js \
+    source/js/outline.js \
+    source/js/lazy_load.js \
+    source/js/fix_contents.js \
+    source/js/fragments.js \
     source/res/mainicon.rc \
     3rdparty/fb2/FictionBookLinks.xsd \
     3rdparty/fb2/FictionBookLang.xsd \
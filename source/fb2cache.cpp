@@ -0,0 +1,194 @@
+#include "fb2cache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtDebug>
+
+#include "fb2imgs.hpp"
+
+#define FB2_CACHE_MAGIC 0x46423243
+#define FB2_CACHE_VERSION 3
+
+//---------------------------------------------------------------------------
+//  FbParseCache
+//
+//    Every cached book takes three files named after the hash of its path:
+//    "*.htm" is not a web page but a QDataStream of the generated HTML,
+//    the collapsed section fragments and the count of node ids,
+//    "*.bin" the packed binaries and
+//    "*.idx" the key and the store index. The index is written last and
+//    removed first, so its presence marks a complete entry.
+//---------------------------------------------------------------------------
+
+FbParseCache::FbParseCache(QIODevice *device)
+    : m_size(0)
+{
+    QSettings settings;
+    if (!settings.value("cache/enabled", true).toBool()) return;
+
+    QFile *file = qobject_cast<QFile*>(device);
+    if (!file || file->fileName().startsWith(":")) return;
+
+    QFileInfo info(*file);
+    m_file = info.absoluteFilePath();
+    m_size = info.size();
+    m_time = info.lastModified();
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    while (!file->atEnd()) hash.addData(file->read(0x10000));
+    file->seek(0);
+    m_hash = hash.result();
+
+    QDir dir(folder());
+    if (!dir.exists() && !dir.mkpath(".")) return;
+    QByteArray key = QCryptographicHash::hash(m_file.toUtf8(), QCryptographicHash::Md5).toHex();
+    m_path = dir.filePath(QString::fromLatin1(key));
+}
+
+QString FbParseCache::folder()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/parse";
+}
+
+bool FbParseCache::readIndex(QByteArray &data, QList<Entry> &list) const
+{
+    QDataStream in(data);
+    quint32 magic; qint32 version;
+    in >> magic >> version;
+    if (magic != FB2_CACHE_MAGIC || version != FB2_CACHE_VERSION) return false;
+
+    QString file; qint64 size; QDateTime time; QByteArray hash;
+    in >> file >> size >> time >> hash;
+    if (file != m_file || size != m_size || time != m_time || hash != m_hash) return false;
+
+    qint32 count;
+    in >> count;
+    for (int i = 0; i < count; i++) {
+        Entry entry;
+        in >> entry.name >> entry.hash >> entry.offset >> entry.size;
+        list.append(entry);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool FbParseCache::load(QString &html, FbStore *store)
+{
+    if (!isEnabled()) return false;
+
+    QFile index(m_path + ".idx");
+    if (!index.open(QFile::ReadOnly)) return false;
+    QByteArray header = index.readAll();
+    index.close();
+
+    QList<Entry> list;
+    if (!readIndex(header, list)) return false;
+
+    QFile text(m_path + ".htm");
+    if (!text.open(QFile::ReadOnly)) return false;
+    QStringList fragments; qint32 nodes;
+    QDataStream stream(&text);
+    stream >> html >> fragments >> nodes;
+    if (stream.status() != QDataStream::Ok) {
+        html.clear();
+        return false;
+    }
+    store->setFragments(fragments);
+    store->setNodes(nodes);
+
+    QFile blob(m_path + ".bin");
+    if (!blob.open(QFile::ReadOnly)) return false;
+    const qint64 total = blob.size();
+    const uchar *data = total ? blob.map(0, total) : 0;
+    if (total && !data) return false;
+
+    foreach (const Entry &entry, list) {
+        if (entry.offset < 0 || entry.size < 0 || entry.offset + entry.size > total) {
+            html.clear();
+            return false;
+        }
+        QByteArray bytes((const char*) data + entry.offset, entry.size);
+        store->set(entry.name, bytes, entry.hash);
+    }
+    if (data) blob.unmap((uchar*) data);
+
+    // Rewriting the index refreshes its time stamp for the LRU eviction.
+    if (index.open(QFile::WriteOnly)) index.write(header);
+    return true;
+}
+
+void FbParseCache::add(const QString &name, const QByteArray &data)
+{
+    if (!isEnabled()) return;
+
+    if (!m_blob.isOpen()) {
+        QFile::remove(m_path + ".idx");
+        m_blob.setFileName(m_path + ".bin");
+        if (!m_blob.open(QFile::WriteOnly)) return;
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.hash = FbBinary::md5(data);
+    entry.offset = m_blob.pos();
+    entry.size = m_blob.write(data);
+    m_list.append(entry);
+}
+
+void FbParseCache::save(const QString &html, const FbStore *store)
+{
+    if (!isEnabled()) return;
+
+    QFile::remove(m_path + ".idx");
+    if (m_blob.isOpen()) {
+        m_blob.close();
+    } else {
+        m_blob.setFileName(m_path + ".bin");
+        if (!m_blob.open(QFile::WriteOnly)) return;
+        m_blob.close();
+    }
+
+    QFile text(m_path + ".htm");
+    if (!text.open(QFile::WriteOnly)) return;
+    QDataStream stream(&text);
+    stream << html << store->fragments() << qint32(store->nodes());
+    text.close();
+
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out << quint32(FB2_CACHE_MAGIC) << qint32(FB2_CACHE_VERSION);
+    out << m_file << m_size << m_time << m_hash;
+    out << qint32(m_list.count());
+    foreach (const Entry &entry, m_list) {
+        out << entry.name << entry.hash << entry.offset << entry.size;
+    }
+
+    QFile index(m_path + ".idx");
+    if (!index.open(QFile::WriteOnly)) return;
+    index.write(header);
+    index.close();
+
+    QSettings settings;
+    prune(settings.value("cache/limit", 256).toLongLong() << 20);
+}
+
+void FbParseCache::prune(qint64 limit)
+{
+    QDir dir(folder());
+    QStringList filters;
+    filters << "*.idx";
+    QFileInfoList list = dir.entryInfoList(filters, QDir::Files, QDir::Time);
+
+    qint64 total = 0;
+    foreach (const QFileInfo &info, list) {
+        QString base = info.absolutePath() + "/" + info.completeBaseName();
+        qint64 size = info.size() + QFileInfo(base + ".htm").size() + QFileInfo(base + ".bin").size();
+        if ((total += size) <= limit) continue;
+        QFile::remove(info.absoluteFilePath());
+        QFile::remove(base + ".htm");
+        QFile::remove(base + ".bin");
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef FB2CACHE_H
+#define FB2CACHE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+class FbStore;
+
+class FbParseCache
+{
+public:
+    explicit FbParseCache(QIODevice *device);
+    bool isEnabled() const { return !m_path.isEmpty(); }
+    bool load(QString &html, FbStore *store);
+    void add(const QString &name, const QByteArray &data);
+    void save(const QString &html, const FbStore *store);
+
+private:
+    class Entry
+    {
+    public:
+        QString name;
+        QString hash;
+        qint64 offset;
+        qint64 size;
+    };
+
+private:
+    static QString folder();
+    static void prune(qint64 limit);
+    bool readIndex(QByteArray &data, QList<Entry> &list) const;
+
+private:
+    QString m_path;
+    QString m_file;
+    qint64 m_size;
+    QDateTime m_time;
+    QByteArray m_hash;
+    QFile m_blob;
+    QList<Entry> m_list;
+};
+
+#endif // FB2CACHE_H
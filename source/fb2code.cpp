@@ -1,56 +1,13 @@
 #include "fb2code.hpp"
 
 #include <QApplication>
-#include <QXmlSchema>
-#include <QAbstractMessageHandler>
-#include <QXmlSchemaValidator>
+#include <QMenu>
+#include <QRegularExpression>
+#include <QScrollBar>
 
 #include "fb2dlgs.hpp"
-
-//---------------------------------------------------------------------------
-//  FbHighlighter
-//---------------------------------------------------------------------------
-
-class FbSchemaHandler : public QAbstractMessageHandler
-{
-    public:
-        FbSchemaHandler()
-            : QAbstractMessageHandler(0)
-        {
-        }
-
-        QString statusMessage() const
-        {
-            return m_description;
-        }
-
-        int line() const
-        {
-            return m_sourceLocation.line();
-        }
-
-        int column() const
-        {
-            return m_sourceLocation.column();
-        }
-
-    protected:
-        virtual void handleMessage(QtMsgType type, const QString &description,
-                                   const QUrl &identifier, const QSourceLocation &sourceLocation)
-        {
-            Q_UNUSED(type);
-            Q_UNUSED(identifier);
-
-            m_messageType = type;
-            m_description = description;
-            m_sourceLocation = sourceLocation;
-        }
-
-    private:
-        QtMsgType m_messageType;
-        QString m_description;
-        QSourceLocation m_sourceLocation;
-};
+#include "fb2piece.hpp"
+#include "fb2valid.hpp"
 
 //---------------------------------------------------------------------------
 //  FbHighlighter
@@ -82,13 +39,51 @@ public:
 
     void setHighlightColor(HighlightType type, QColor color, bool foreground = true);
     void setHighlightFormat(HighlightType type, QTextCharFormat format);
+    void setWindow(int first, int last);
 
 protected:
     void highlightBlock(const QString& rstrText);
-    int  processDefaultText(int i, const QString& rstrText);
 
 private:
+    enum BlockState
+    {
+        NoBlock = -1,
+        InText,
+        InElement,
+        InComment,
+        InCData,
+        InQuote,
+        InApostrophe,
+        Stale
+    };
+
+    enum CharClass
+    {
+        IsSpace  = 0x01,
+        IsStart  = 0x02,
+        IsName   = 0x04,
+        IsBase64 = 0x08
+    };
+
+    enum { Lookahead = 100 };
+
+    class CharTable
+    {
+    public:
+        CharTable();
+        uchar data[128];
+    };
+
+    class Formatted : public QTextBlockUserData {};
+
     void init();
+    static bool is(QChar ch, int mask);
+    static bool isBinary(const QString &text);
+    static int skipName(const QString &text, int i);
+    int start(const QTextBlock &block);
+    int next(const QString &text, int state);
+    int lex(const QString &text, int state);
+    void apply(int start, int count, const QTextCharFormat &format);
 
     QTextCharFormat fmtSyntaxChar;
     QTextCharFormat fmtElementName;
@@ -98,24 +93,9 @@ private:
     QTextCharFormat fmtError;
     QTextCharFormat fmtOther;
 
-    enum ParsingState
-    {
-        NoState = 0,
-        ExpectElementNameOrSlash,
-        ExpectElementName,
-        ExpectAttributeOrEndOfElement,
-        ExpectEqual,
-        ExpectAttributeValue
-    };
-
-    enum BlockState
-    {
-        NoBlock = -1,
-        InComment,
-        InElement
-    };
-
-    ParsingState state;
+    int m_first;
+    int m_last;
+    bool m_paint;
 };
 
 static const QColor DEFAULT_SYNTAX_CHAR     = Qt::blue;
@@ -126,13 +106,19 @@ static const QColor DEFAULT_ATTRIBUTE_VALUE = Qt::darkGreen;
 static const QColor DEFAULT_ERROR           = Qt::darkMagenta;
 static const QColor DEFAULT_OTHER           = Qt::black;
 
-// Regular expressions for parsing XML borrowed from:
-// http://www.cs.sfu.ca/~cameron/REX.html
-static const QString EXPR_COMMENT			= "<!--[^-]*-([^-][^-]*-)*->";
-static const QString EXPR_COMMENT_BEGIN		= "<!--";
-static const QString EXPR_COMMENT_END		= "[^-]*-([^-][^-]*-)*->";
-static const QString EXPR_ATTRIBUTE_VALUE	= "\"[^<\"]*\"|'[^<']*'";
-static const QString EXPR_NAME				= "([A-Za-z_:]|[^\\x00-\\x7F])([A-Za-z0-9_:.-]|[^\\x00-\\x7F])*";
+FbHighlighter::CharTable::CharTable()
+{
+    for (int i = 0; i < 128; i++) {
+        uchar flags = 0;
+        bool alpha = ('A' <= i && i <= 'Z') || ('a' <= i && i <= 'z');
+        bool digit = '0' <= i && i <= '9';
+        if (i == ' ' || i == '\t' || i == '\r' || i == '\n') flags |= IsSpace;
+        if (alpha || i == '_' || i == ':') flags |= IsStart | IsName;
+        if (digit || i == '.' || i == '-') flags |= IsName;
+        if (alpha || digit || i == '+' || i == '/' || i == '=') flags |= IsBase64;
+        data[i] = flags;
+    }
+}
 
 FbHighlighter::FbHighlighter(QObject* parent)
 : QSyntaxHighlighter(parent)
@@ -165,6 +151,9 @@ void FbHighlighter::init()
     fmtAttributeValue.setForeground(DEFAULT_ATTRIBUTE_VALUE);
     fmtError.setForeground(DEFAULT_ERROR);
     fmtOther.setForeground(DEFAULT_OTHER);
+    m_first = 0;
+    m_last = 0;
+    m_paint = true;
 }
 
 void FbHighlighter::setHighlightColor(HighlightType type, QColor color, bool foreground)
@@ -206,242 +195,195 @@ void FbHighlighter::setHighlightFormat(HighlightType type, QTextCharFormat forma
     rehighlight();
 }
 
-void FbHighlighter::highlightBlock(const QString& text)
+void FbHighlighter::setWindow(int first, int last)
 {
-    int i = 0;
-    int pos = 0;
-    int brackets = 0;
-
-    state = (previousBlockState() == InElement ? ExpectAttributeOrEndOfElement : NoState);
+    // Blocks left stale while they were off screen get their state
+    // and formats once they come close to the visible part of the view.
+    m_first = first;
+    m_last = last;
+    if (!document()) return;
 
-    if (previousBlockState() == InComment)
-    {
-        // search for the end of the comment
-        QRegExp expression(EXPR_COMMENT_END);
-        pos = expression.indexIn(text, i);
-
-        if (pos >= 0)
-        {
-            // end comment found
-            const int iLength = expression.matchedLength();
-            setFormat(0, iLength - 3, fmtComment);
-            setFormat(iLength - 3, 3, fmtSyntaxChar);
-            i += iLength; // skip comment
-        }
-        else
-        {
-            // in comment
-            setFormat(0, text.length(), fmtComment);
-            setCurrentBlockState(InComment);
-            return;
-        }
+    int number = qMax(0, first - Lookahead);
+    QTextBlock block = document()->findBlockByNumber(number);
+    while (block.isValid() && number <= last + Lookahead) {
+        if (!block.userData()) rehighlightBlock(block);
+        block = block.next();
+        number++;
     }
+}
 
-    for (; i < text.length(); i++)
-    {
-        switch (text.at(i).toLatin1())
-        {
-        case '<':
-            brackets++;
-            if (brackets == 1)
-            {
-                setFormat(i, 1, fmtSyntaxChar);
-                state = ExpectElementNameOrSlash;
-            }
-            else
-            {
-                // wrong bracket nesting
-                setFormat(i, 1, fmtError);
-            }
-            break;
-
-        case '>':
-            brackets--;
-            if (brackets == 0)
-            {
-                setFormat(i, 1, fmtSyntaxChar);
-            }
-            else
-            {
-                // wrong bracket nesting
-                setFormat( i, 1, fmtError);
-            }
-            state = NoState;
-            break;
-
-        case '/':
-            if (state == ExpectElementNameOrSlash)
-            {
-                state = ExpectElementName;
-                setFormat(i, 1, fmtSyntaxChar);
-            }
-            else
-            {
-                if (state == ExpectAttributeOrEndOfElement)
-                {
-                    setFormat(i, 1, fmtSyntaxChar);
-                }
-                else
-                {
-                    processDefaultText(i, text);
-                }
-            }
-            break;
-
-        case '=':
-            if (state == ExpectEqual)
-            {
-                state = ExpectAttributeValue;
-                setFormat(i, 1, fmtOther);
-            }
-            else
-            {
-                processDefaultText(i, text);
-            }
-            break;
-
-        case '\'':
-        case '\"':
-            if (state == ExpectAttributeValue)
-            {
-                // search attribute value
-                QRegExp expression(EXPR_ATTRIBUTE_VALUE);
-                pos = expression.indexIn(text, i);
+bool FbHighlighter::is(QChar ch, int mask)
+{
+    static const CharTable table;
+    ushort code = ch.unicode();
+    if (code >= 128) return mask & (IsStart | IsName);
+    return table.data[code] & mask;
+}
 
-                if (pos == i) // attribute value found ?
-                {
-                    const int iLength = expression.matchedLength();
+bool FbHighlighter::isBinary(const QString &text)
+{
+    const QChar *data = text.constData();
+    const QChar *end = data + text.length();
+    while (data < end) {
+        if (!is(*data++, IsBase64 | IsSpace)) return false;
+    }
+    return true;
+}
 
-                    setFormat(i, 1, fmtOther);
-                    setFormat(i + 1, iLength - 2, fmtAttributeValue);
-                    setFormat(i + iLength - 1, 1, fmtOther);
+int FbHighlighter::skipName(const QString &text, int i)
+{
+    int length = text.length();
+    while (i < length && is(text.at(i), IsName)) i++;
+    return i;
+}
 
-                    i += iLength - 1; // skip attribute value
-                    state = ExpectAttributeOrEndOfElement;
-                }
-                else
-                {
-                    processDefaultText(i, text);
-                }
-            }
-            else
-            {
-                processDefaultText(i, text);
-            }
-            break;
+void FbHighlighter::apply(int start, int count, const QTextCharFormat &format)
+{
+    if (m_paint && count > 0) setFormat(start, count, format);
+}
 
-        case '!':
-            if (state == ExpectElementNameOrSlash)
-            {
-                // search comment
-                QRegExp expression(EXPR_COMMENT);
-                pos = expression.indexIn(text, i - 1);
-
-                if (pos == i - 1) // comment found ?
-                {
-                    const int iLength = expression.matchedLength();
-
-                    setFormat(pos, 4, fmtSyntaxChar);
-                    setFormat(pos + 4, iLength - 7, fmtComment);
-                    setFormat(iLength - 3, 3, fmtSyntaxChar);
-                    i += iLength - 2; // skip comment
-                    state = NoState;
-                    brackets--;
-                }
-                else
-                {
-                    // Try find multiline comment
-                    QRegExp expression(EXPR_COMMENT_BEGIN); // search comment start
-                    pos = expression.indexIn(text, i - 1);
-
-                    //if (pos == i - 1) // comment found ?
-                    if (pos >= i - 1)
-                    {
-                        setFormat(i, 3, fmtSyntaxChar);
-                        setFormat(i + 3, text.length() - i - 3, fmtComment);
-                        setCurrentBlockState(InComment);
-                        return;
-                    }
-                    else
-                    {
-                        processDefaultText(i, text);
-                    }
-                }
-            }
-            else
-            {
-                processDefaultText(i, text);
-            }
+void FbHighlighter::highlightBlock(const QString& text)
+{
+    // Blocks far from the visible part are not lexed at all, they are
+    // marked stale and a cascade after an edit stops at the first one
+    // that was stale already. Their state is worked out only once a
+    // block after them comes close to the visible part.
+    int number = currentBlock().blockNumber();
+    m_paint = m_first - Lookahead <= number && number <= m_last + Lookahead;
+    if (!m_paint) {
+        setCurrentBlockUserData(0);
+        setCurrentBlockState(Stale);
+        return;
+    }
+    if (!currentBlockUserData()) setCurrentBlockUserData(new Formatted);
 
-            break;
+    int state = previousBlockState();
+    if (state == Stale) state = start(currentBlock());
+    setCurrentBlockState(next(text, state));
+}
 
-        default:
-            const int iLength = processDefaultText(i, text);
-            if (iLength > 0)
-                i += iLength - 1;
-            break;
-        }
-    }
+int FbHighlighter::start(const QTextBlock &block)
+{
+    // Stale blocks before this one are lexed for their end state, which
+    // is stored with them, so the walk is not repeated on later calls.
+    QTextBlock first = block.previous();
+    while (first.previous().isValid() && first.previous().userState() == Stale) first = first.previous();
+    QTextBlock prior = first.previous();
+    int state = prior.isValid() ? prior.userState() : NoBlock;
 
-    if (state == ExpectAttributeOrEndOfElement)
-    {
-        setCurrentBlockState(InElement);
+    bool paint = m_paint;
+    m_paint = false;
+    for (QTextBlock stale = first; stale != block; stale = stale.next()) {
+        state = next(stale.text(), state);
+        stale.setUserState(state);
     }
+    m_paint = paint;
+    return state;
 }
 
-int FbHighlighter::processDefaultText(int i, const QString& text)
+int FbHighlighter::next(const QString &text, int state)
 {
-    // length of matched text
-    int iLength = 0;
+    if (state == NoBlock) state = InText;
 
-    switch(state)
-    {
-    case ExpectElementNameOrSlash:
-    case ExpectElementName:
-        {
-            // search element name
-            QRegExp expression(EXPR_NAME);
-            const int pos = expression.indexIn(text, i);
-
-            if (pos == i) // found ?
-            {
-                iLength = expression.matchedLength();
-
-                setFormat(pos, iLength, fmtElementName);
-                state = ExpectAttributeOrEndOfElement;
-            }
-            else
-            {
-                setFormat(i, 1, fmtOther);
-            }
-        }
-        break;
+    // Base64 data and blank lines carry no markup at all
+    if (state == InText && isBinary(text)) {
+        apply(0, text.length(), fmtOther);
+        return InText;
+    }
 
-    case ExpectAttributeOrEndOfElement:
-        {
-            // search attribute name
-            QRegExp expression(EXPR_NAME);
-            const int pos = expression.indexIn(text, i);
+    return lex(text, state);
+}
 
-            if (pos == i) // found ?
-            {
-                iLength = expression.matchedLength();
+int FbHighlighter::lex(const QString& text, int state)
+{
+    const int length = text.length();
+    int i = 0;
+    while (i < length) {
+        switch (state) {
+            case InComment:
+            case InCData: {
+                const QString close = state == InComment ? "-->" : "]]>";
+                const QTextCharFormat &body = state == InComment ? fmtComment : fmtOther;
+                int end = text.indexOf(close, i);
+                if (end < 0) {
+                    apply(i, length - i, body);
+                    return state;
+                }
+                apply(i, end - i, body);
+                apply(end, 3, fmtSyntaxChar);
+                i = end + 3;
+                state = InText;
+            } break;
+
+            case InQuote:
+            case InApostrophe: {
+                QChar quote = state == InQuote ? '"' : '\'';
+                int end = text.indexOf(quote, i);
+                if (end < 0) {
+                    apply(i, length - i, fmtAttributeValue);
+                    return state;
+                }
+                apply(i, end - i, fmtAttributeValue);
+                apply(end, 1, fmtOther);
+                i = end + 1;
+                state = InElement;
+            } break;
+
+            case InElement: {
+                QChar ch = text.at(i);
+                if (is(ch, IsSpace)) {
+                    i++;
+                } else if (ch == '>') {
+                    apply(i++, 1, fmtSyntaxChar);
+                    state = InText;
+                } else if (ch == '/' || ch == '?') {
+                    apply(i++, 1, fmtSyntaxChar);
+                } else if (ch == '=') {
+                    apply(i++, 1, fmtOther);
+                } else if (ch == '"' || ch == '\'') {
+                    apply(i++, 1, fmtOther);
+                    state = ch == '"' ? InQuote : InApostrophe;
+                } else if (is(ch, IsStart)) {
+                    int end = skipName(text, i);
+                    apply(i, end - i, fmtAttributeName);
+                    i = end;
+                } else {
+                    // wrong bracket nesting or a stray character
+                    apply(i++, 1, fmtError);
+                }
+            } break;
 
-                setFormat(pos, iLength, fmtAttributeName);
-                state = ExpectEqual;
-            }
-            else
-            {
-                setFormat(i, 1, fmtOther);
+            default: {
+                int end = text.indexOf('<', i);
+                if (end < 0) {
+                    apply(i, length - i, fmtOther);
+                    return InText;
+                }
+                apply(i, end - i, fmtOther);
+                i = end;
+                if (text.midRef(i, 4) == QLatin1String("<!--")) {
+                    apply(i, 4, fmtSyntaxChar);
+                    i += 4;
+                    state = InComment;
+                } else if (text.midRef(i, 9) == QLatin1String("<![CDATA[")) {
+                    apply(i, 9, fmtSyntaxChar);
+                    i += 9;
+                    state = InCData;
+                } else {
+                    int start = i + 1;
+                    if (start < length) {
+                        QChar ch = text.at(start);
+                        if (ch == '/' || ch == '?' || ch == '!') start++;
+                    }
+                    apply(i, start - i, fmtSyntaxChar);
+                    i = skipName(text, start);
+                    apply(start, i - start, fmtElementName);
+                    state = InElement;
+                }
             }
         }
-        break;
-
-    default:
-        setFormat(i, 1, fmtOther);
-        break;
     }
-    return iLength;
+    return state;
 }
 
 //---------------------------------------------------------------------------
@@ -452,15 +394,24 @@ qreal FbCodeEdit::baseFontSize = 10;
 qreal FbCodeEdit::zoomRatioMin = 0.2;
 qreal FbCodeEdit::zoomRatioMax = 5.0;
 
-FbCodeEdit::FbCodeEdit(QWidget *parent) : QPlainTextEdit(parent)
+FbCodeEdit::FbCodeEdit(QWidget *parent)
+    : QPlainTextEdit(parent)
+    , m_large(0)
+    , m_base(0)
+    , m_from(0)
+    , m_to(0)
+    , m_shifting(false)
+    , m_crlf(false)
 {
     lineNumberArea = new LineNumberArea(this);
-    FbHighlighter *highlighter = new FbHighlighter(this);
-    highlighter->setDocument( document() );
+    m_highlighter = new FbHighlighter(this);
+    m_highlighter->setDocument( document() );
 
     connect(this, SIGNAL(blockCountChanged(int)), this, SLOT(updateLineNumberAreaWidth(int)));
     connect(this, SIGNAL(updateRequest(QRect,int)), this, SLOT(updateLineNumberArea(QRect,int)));
+    connect(this, SIGNAL(updateRequest(QRect,int)), this, SLOT(updateHighlighter()));
     connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(highlightCurrentLine()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(scrollWindow(int)));
 
     zoomRatio = 1;
 
@@ -472,6 +423,11 @@ FbCodeEdit::FbCodeEdit(QWidget *parent) : QPlainTextEdit(parent)
     highlightCurrentLine();
 }
 
+FbCodeEdit::~FbCodeEdit()
+{
+    delete m_large;
+}
+
 QAction * FbCodeEdit::act(Fb::Actions index) const
 {
     return m_actions[index];
@@ -546,6 +502,7 @@ void FbCodeEdit::clipboardDataChanged()
 
 bool FbCodeEdit::read(QIODevice *device)
 {
+    closeLarge();
     QByteArray data = device->readAll();
     delete device;
     QXmlInputSource source;
@@ -557,7 +514,7 @@ bool FbCodeEdit::read(QIODevice *device)
 int FbCodeEdit::lineNumberAreaWidth()
 {
     int digits = 1;
-    int max = qMax(1, blockCount());
+    int max = qMax(1, m_large ? m_large->lineCount() : blockCount());
     while (max >= 10) {
         max /= 10;
         ++digits;
@@ -584,6 +541,21 @@ void FbCodeEdit::updateLineNumberArea(const QRect &rect, int dy)
         updateLineNumberAreaWidth(0);
 }
 
+void FbCodeEdit::updateHighlighter()
+{
+    QTextBlock block = firstVisibleBlock();
+    int first = block.blockNumber();
+    int last = first;
+    int top = (int) blockBoundingGeometry(block).translated(contentOffset()).top();
+    int bottom = viewport()->rect().bottom();
+    while (block.isValid() && top <= bottom) {
+        top += (int) blockBoundingRect(block).height();
+        block = block.next();
+        ++last;
+    }
+    m_highlighter->setWindow(first, last);
+}
+
 void FbCodeEdit::resizeEvent(QResizeEvent *e)
 {
     QPlainTextEdit::resizeEvent(e);
@@ -617,7 +589,7 @@ void FbCodeEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
     painter.fillRect(event->rect(), Qt::lightGray);
 
     QTextBlock block = firstVisibleBlock();
-    int blockNumber = block.blockNumber();
+    int blockNumber = block.blockNumber() + m_base;
     int top = (int) blockBoundingGeometry(block).translated(contentOffset()).top();
     int bottom = top + (int) blockBoundingRect(block).height();
 
@@ -638,7 +610,164 @@ void FbCodeEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
 
 bool FbCodeEdit::findText(const QString &exp, QTextDocument::FindFlags options)
 {
-    return QPlainTextEdit::find(exp, options);
+    if (QPlainTextEdit::find(exp, options)) return true;
+    return m_large && findLarge(exp, options);
+}
+
+bool FbCodeEdit::isModified() const
+{
+    return document()->isModified() || (m_large && m_large->isModified());
+}
+
+bool FbCodeEdit::open(const QString &filename)
+{
+    // A large file stays mapped: only a window of lines is loaded
+    // into the document, edits are kept by the piece table.
+    closeLarge();
+    FbPieceTable *table = new FbPieceTable;
+    if (!table->open(filename)) {
+        qCritical() << tr("Cannot map file %1: %2.").arg(filename, table->errorString());
+        delete table;
+        return false;
+    }
+    setPlainText(QString());
+    m_large = table;
+    showWindow(0);
+    updateLineNumberAreaWidth(0);
+    return true;
+}
+
+bool FbCodeEdit::save(const QString &filename)
+{
+    if (!m_large) return false;
+    commitWindow();
+    if (!m_large->save(filename)) {
+        qCritical() << tr("Cannot write file %1: %2.").arg(filename, m_large->errorString());
+        return false;
+    }
+    document()->setModified(false);
+    return true;
+}
+
+void FbCodeEdit::closeLarge()
+{
+    if (!m_large) return;
+    delete m_large;
+    m_large = 0;
+    m_base = 0;
+    m_from = 0;
+    m_to = 0;
+}
+
+void FbCodeEdit::commitWindow()
+{
+    // Only the bytes that differ from the table are replaced
+    if (!m_large || !document()->isModified()) return;
+    QByteArray before = m_large->read(m_from, m_to - m_from);
+    QByteArray after = m_large->encode(windowText());
+    if (before == after) return;
+    int size = qMin(before.size(), after.size());
+    int head = 0;
+    while (head < size && before.at(head) == after.at(head)) head++;
+    int tail = 0;
+    while (tail < size - head && before.at(before.size() - tail - 1) == after.at(after.size() - tail - 1)) tail++;
+    m_large->replace(m_from + head, before.size() - head - tail, after.mid(head, after.size() - head - tail));
+    m_to = m_from + after.size();
+}
+
+QString FbCodeEdit::windowText() const
+{
+    // Unlike toPlainText(), blocks keep non-breaking spaces and are
+    // joined by the line ends the window was read with.
+    QString result;
+    QString eol = m_crlf ? "\r\n" : "\n";
+    for (QTextBlock block = document()->begin(); block.isValid(); block = block.next()) {
+        if (block != document()->begin()) result += eol;
+        result += block.text();
+    }
+    return result;
+}
+
+int FbCodeEdit::windowOffset(const QByteArray &bytes) const
+{
+    // Length in the document of the decoded bytes, a line end is one character there
+    QString text = m_large->decode(bytes);
+    return text.length() - (m_crlf ? text.count("\r\n") : 0);
+}
+
+void FbCodeEdit::showWindow(int line)
+{
+    commitWindow();
+    int count = m_large->lineCount();
+    m_base = qBound(0, line - WindowLines / 2, qMax(0, count - WindowLines));
+    int last = qMin(count, m_base + WindowLines);
+    m_from = m_large->lineStart(m_base);
+    m_to = last < count ? m_large->lineStart(last) - 1 : m_large->size();
+
+    // A window that stops before the last line ends before its "\r\n",
+    // a lone '\r' would become an extra block in the document.
+    QByteArray bytes = m_large->read(m_from, m_to - m_from);
+    bool cr = last < count && bytes.endsWith('\r');
+    if (cr) {
+        bytes.chop(1);
+        m_to--;
+    }
+    int eol = bytes.indexOf('\n');
+    m_crlf = eol > 0 ? bytes.at(eol - 1) == '\r' : cr;
+
+    m_shifting = true;
+    setPlainText(m_large->decode(bytes));
+    m_shifting = false;
+    emit modificationChanged(isModified());
+}
+
+void FbCodeEdit::scrollWindow(int value)
+{
+    // Reaching an edge of the window loads the lines around it
+    if (!m_large || m_shifting) return;
+    QScrollBar *bar = verticalScrollBar();
+    bool up = value == bar->minimum() && m_base > 0;
+    bool down = value == bar->maximum() && m_base + blockCount() < m_large->lineCount();
+    if (!up && !down) return;
+
+    int top = m_base + firstVisibleBlock().blockNumber();
+    int line = m_base + textCursor().blockNumber();
+    int column = textCursor().positionInBlock();
+    showWindow(top);
+
+    m_shifting = true;
+    bool inside = m_base <= line && line < m_base + blockCount();
+    QTextBlock block = document()->findBlockByNumber((inside ? line : top) - m_base);
+    QTextCursor cursor(block);
+    if (inside) cursor.setPosition(block.position() + qMin(column, block.length() - 1));
+    setTextCursor(cursor);
+    bar->setValue(top - m_base);
+    m_shifting = false;
+}
+
+bool FbCodeEdit::findLarge(const QString &exp, QTextDocument::FindFlags options)
+{
+    // Nothing more in the window: the rest of the file is searched
+    // in the piece table and the window moves to the match.
+    commitWindow();
+    QString pattern = QRegularExpression::escape(exp);
+    if (options & QTextDocument::FindWholeWords) pattern = "\\b" + pattern + "\\b";
+    QRegularExpression expr(pattern);
+    if (!(options & QTextDocument::FindCaseSensitively)) expr.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+
+    bool backward = options & QTextDocument::FindBackward;
+    qint64 length = 0;
+    qint64 pos = m_large->find(expr, backward ? m_from : m_to, backward, length);
+    if (pos < 0) return false;
+
+    showWindow(m_large->lineOf(pos));
+    int start = windowOffset(m_large->read(m_from, pos - m_from));
+    int count = windowOffset(m_large->read(pos, length));
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(start);
+    cursor.setPosition(start + count, QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+    return true;
 }
 
 void FbCodeEdit::find()
@@ -678,36 +807,70 @@ void FbCodeEdit::setZoomRatio(qreal ratio)
 
 void FbCodeEdit::validate()
 {
-    FbSchemaHandler handler;
-
-    QXmlSchema schema;
-    schema.setMessageHandler(&handler);
-
-    QUrl url("qrc:/fb2/FictionBook2.1.xsd");
-    schema.load(url);
-    if (!schema.isValid()) {
-        status(tr("Schema is not valid: ") + handler.statusMessage());
+    // A second click stops the running check
+    if (m_validator) {
+        m_validator->cancel();
         return;
     }
+    if (m_large) {
+        status(tr("Validation is not available for large files"));
+        return;
+    }
+    m_validator = FbValidator::execute(this, toPlainText());
+    status(tr("Validation..."));
+}
 
-    const QByteArray data = toPlainText().toUtf8();
-    QXmlSchemaValidator validator(schema);
-    if (!validator.validate(data)) {
-        setCursor(handler.line(), handler.column());
-        status(handler.statusMessage());
+void FbCodeEdit::validated()
+{
+    FbValidator *validator = qobject_cast<FbValidator*>(sender());
+    if (!validator) return;
+    if (validator->isCancelled()) {
+        status(tr("Validation cancelled"));
+    } else if (validator->errors()) {
+        setCursor(validator->row(), validator->col());
+        status(tr("Validation failed: %1 errors").arg(validator->errors()));
     } else {
         status(tr("Validation successful"));
     }
 }
 
+void FbCodeEdit::contextMenuEvent(QContextMenuEvent *event)
+{
+    QMenu *menu = createStandardContextMenu();
+    QTextBlock block = cursorForPosition(event->pos()).block();
+    QAction *expand = 0;
+    if (block.text().contains(QRegularExpression("<!-- \\d+ bytes -->"))) {
+        menu->addSeparator();
+        expand = menu->addAction(tr("Expand binary"));
+    }
+    QAction *action = menu->exec(event->globalPos());
+    if (action && action == expand) emit expandBinary(block.position());
+    delete menu;
+}
+
+int FbCodeEdit::position(int line, int column) const
+{
+    // Lines and columns are counted from 1, as the parsers report them
+    QTextBlock block = document()->findBlockByNumber(line - 1);
+    if (!block.isValid()) block = document()->lastBlock();
+    int offset = qBound(0, column - 1, block.length() - 1);
+    return block.position() + offset;
+}
+
 void FbCodeEdit::setCursor(int line, int column)
 {
-    moveCursor(QTextCursor::Start);
-    for (int i = 1; i < line; ++i)
-        moveCursor(QTextCursor::Down);
+    if (m_large) {
+        if (line <= m_base || line > m_base + blockCount()) showWindow(line - 1);
+        line -= m_base;
+    }
+    setPosition(position(line, column));
+}
 
-    for (int i = 1; i < column; ++i)
-        moveCursor(QTextCursor::Right);
+void FbCodeEdit::setPosition(int position)
+{
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(position);
+    setTextCursor(cursor);
 
     QList<QTextEdit::ExtraSelection> extraSelections;
     QTextEdit::ExtraSelection selection;
@@ -4,6 +4,7 @@
 #include <QByteArray>
 #include <QObject>
 #include <QPlainTextEdit>
+#include <QPointer>
 #include <QTextCharFormat>
 #include <QColor>
 #include <QTextEdit>
@@ -12,18 +13,24 @@
 #include "fb2mode.h"
 
 QT_BEGIN_NAMESPACE
+class QContextMenuEvent;
 class QPaintEvent;
 class QResizeEvent;
 class QSize;
 class QWidget;
 QT_END_NAMESPACE
 
+class FbHighlighter;
+class FbPieceTable;
+class FbValidator;
+
 class FbCodeEdit : public QPlainTextEdit
 {
     Q_OBJECT
 
 public:
     FbCodeEdit(QWidget *parent = 0);
+    ~FbCodeEdit();
 
     QAction * act(Fb::Actions index) const;
     void setAction(Fb::Actions index, QAction *action);
@@ -35,32 +42,50 @@ public:
     bool read(QIODevice *device);
 
     void load(const QByteArray data)
-        { setPlainText(QString::fromUtf8(data.data())); }
+        { closeLarge(); setPlainText(QString::fromUtf8(data.data())); }
+
+    bool open(const QString &filename);
+
+    bool save(const QString &filename);
+
+    bool isLarge() const { return m_large; }
 
     bool findText(const QString &exp, QTextDocument::FindFlags options = 0);
 
-    bool isModified() const { return document()->isModified(); }
+    bool isModified() const;
 
+    int position(int line, int column) const;
+    void setPosition(int position);
     void setCursor(int line, int column);
 
 signals:
     void status(const QString &text);
+    void warning(int row, int col, const QString &msg);
+    void error(int row, int col, const QString &msg);
+    void fatal(int row, int col, const QString &msg);
+    void expandBinary(int position);
 
 protected:
     void resizeEvent(QResizeEvent *event);
+    void contextMenuEvent(QContextMenuEvent *event);
 
 private slots:
     void clipboardDataChanged();
     void updateLineNumberAreaWidth(int newBlockCount);
     void highlightCurrentLine();
     void updateLineNumberArea(const QRect &, int);
+    void updateHighlighter();
+    void scrollWindow(int value);
     void find();
     void validate();
+    void validated();
     void zoomIn();
     void zoomOut();
     void zoomReset();
 
 private:
+    enum { WindowLines = 4000 };
+
     class LineNumberArea : public QWidget
     {
     public:
@@ -76,10 +101,24 @@ private:
     void lineNumberAreaPaintEvent(QPaintEvent *event);
     int lineNumberAreaWidth();
     void setZoomRatio(qreal ratio);
+    void closeLarge();
+    void commitWindow();
+    void showWindow(int line);
+    QString windowText() const;
+    int windowOffset(const QByteArray &bytes) const;
+    bool findLarge(const QString &exp, QTextDocument::FindFlags options);
 
 private:
     QWidget *lineNumberArea;
+    FbHighlighter *m_highlighter;
     FbActionMap m_actions;
+    QPointer<FbValidator> m_validator;
+    FbPieceTable *m_large;
+    int m_base;
+    qint64 m_from;
+    qint64 m_to;
+    bool m_shifting;
+    bool m_crlf;
     qreal zoomRatio;
     static qreal baseFontSize;
     static qreal zoomRatioMin;
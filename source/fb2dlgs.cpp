@@ -49,39 +49,6 @@ void FbCodeFindDlg::find()
     m_edit.findText(text, options);
 }
 
-//---------------------------------------------------------------------------
-//  FbTextFindDlg
-//---------------------------------------------------------------------------
-
-FbTextFindDlg::FbTextFindDlg(FbTextEdit &edit)
-    : QDialog(&edit)
-    , ui(new Ui::FbFind)
-    , m_edit(edit)
-{
-    ui->setupUi(this);
-    ui->checkHigh->hide();
-    connect(ui->btnFind, SIGNAL(clicked()), this, SLOT(find()));
-}
-
-FbTextFindDlg::~FbTextFindDlg()
-{
-    m_edit.findText(QString(), QWebPage::HighlightAllOccurrences);
-    delete ui;
-}
-
-void FbTextFindDlg::find()
-{
-    QString text = ui->editText->text();
-    if (text.isEmpty()) return;
-    QWebPage::FindFlags options = QWebPage::FindWrapsAroundDocument;
-    if (ui->radioUp->isChecked()) options |= QWebPage::FindBackward;
-    if (ui->checkCase->isChecked()) options |= QWebPage::FindCaseSensitively;
-    m_edit.findText(text, options);
-
-    options |= QWebPage::HighlightAllOccurrences;
-    m_edit.findText(text, options);
-}
-
 //---------------------------------------------------------------------------
 //  FbSetupDlg
 //---------------------------------------------------------------------------
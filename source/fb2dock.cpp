@@ -2,9 +2,12 @@
 #include "fb2code.hpp"
 #include "fb2head.hpp"
 #include "fb2page.hpp"
+#include "fb2sync.hpp"
 #include "fb2text.hpp"
 
+#include <QFileInfo>
 #include <QLayout>
+#include <QSettings>
 #include <QtDebug>
 
 //---------------------------------------------------------------------------
@@ -50,6 +53,8 @@ FbMainDock::FbMainDock(QWidget *parent)
 
     m_code = new FbCodeEdit(this);
 
+    m_sync = new FbSyncMap(m_text, m_code, this);
+
     addWidget(textFrame);
     addWidget(m_head);
     addWidget(m_code);
@@ -57,12 +62,16 @@ FbMainDock::FbMainDock(QWidget *parent)
     connect(m_text->page(), SIGNAL(warning(int,int,QString)), parent, SLOT(warning(int,int,QString)));
     connect(m_text->page(), SIGNAL(error(int,int,QString)), parent, SLOT(error(int,int,QString)));
     connect(m_text->page(), SIGNAL(fatal(int,int,QString)), parent, SLOT(fatal(int,int,QString)));
-    connect(m_text->page(), SIGNAL(error(int,int,QString)), SLOT(error(int,int)));
-    connect(m_text->page(), SIGNAL(fatal(int,int,QString)), SLOT(error(int,int)));
+    connect(m_text->page(), SIGNAL(logged(QVariantList)), parent, SLOT(logged(QVariantList)));
+    connect(m_text->page(), SIGNAL(parseFailed(int,int)), SLOT(error(int,int)));
     connect(m_text->page(), SIGNAL(status(QString)), parent, SLOT(status(QString)));
     connect(m_text, SIGNAL(modificationChanged(bool)), SLOT(textChanged(bool)));
+    connect(m_text, SIGNAL(showNode(int)), SLOT(showNode(int)));
     connect(m_head, SIGNAL(modificationChanged(bool)), SLOT(textChanged(bool)));
     connect(m_code, SIGNAL(modificationChanged(bool)), SLOT(textChanged(bool)));
+    connect(m_code, SIGNAL(warning(int,int,QString)), parent, SLOT(warning(int,int,QString)));
+    connect(m_code, SIGNAL(error(int,int,QString)), parent, SLOT(error(int,int,QString)));
+    connect(m_code, SIGNAL(fatal(int,int,QString)), parent, SLOT(fatal(int,int,QString)));
     connect(m_head, SIGNAL(status(QString)), parent, SLOT(status(QString)));
     connect(m_code, SIGNAL(status(QString)), parent, SLOT(status(QString)));
     connect(this, SIGNAL(status(QString)), parent, SLOT(status(QString)));
@@ -71,25 +80,25 @@ FbMainDock::FbMainDock(QWidget *parent)
 void FbMainDock::switchMode(Fb::Mode mode)
 {
     if (mode == m_mode) return;
+    if (m_code->isLarge() && mode != Fb::Code) {
+        emit status(tr("Large files are edited in the code view only"));
+        m_actions[m_mode]->setChecked(true);
+        return;
+    }
+    if (currentWidget() == m_code && m_mode == Fb::Code && !m_sync->codeToText()) {
+        emit status(tr("A binary placeholder has no data, the text cannot be built"));
+        m_actions[m_mode]->setChecked(true);
+        return;
+    }
     isSwitched = isModified();
     if (currentWidget() == m_code) {
-        QString xml = m_code->toPlainText();
         switch (m_mode) {
-            case Fb::Code: m_text->page()->read(xml); break;
-            case Fb::Html: m_text->setHtml(xml, m_text->url()); break;
+            case Fb::Html: m_text->setHtml(m_code->toPlainText(), m_text->url()); break;
             default: ;
         }
     } else {
         switch (mode) {
-            case Fb::Code: {
-                QString xml; int anchor, focus;
-                m_text->save(&xml, anchor, focus);
-                m_code->setPlainText(xml);
-                QTextCursor cursor = m_code->textCursor();
-                if (anchor > 0) cursor.setPosition(anchor, QTextCursor::MoveAnchor);
-                if (focus > 0) cursor.setPosition(focus, QTextCursor::KeepAnchor);
-                m_code->setTextCursor(cursor);
-            } break;
+            case Fb::Code: m_sync->textToCode(); break;
             case Fb::Html: {
                 QString html = m_text->toHtml();
                 m_code->setPlainText(html);
@@ -154,6 +163,27 @@ void FbMainDock::setModeHtml()
     m_code->connectActions(m_tool);
 }
 
+void FbMainDock::showLine(int row, int col)
+{
+    // Messages point at lines of the code view
+    if (row <= 0) return;
+    switchMode(Fb::Code);
+    if (m_mode != Fb::Code) return;
+    if (QAction *action = m_actions.value(Fb::Code)) action->setChecked(true);
+    m_code->setCursor(row, col);
+}
+
+void FbMainDock::showNode(int id)
+{
+    // Top-level sections are found through the sync map, which
+    // follows the edits of the code view without scanning it.
+    switchMode(Fb::Code);
+    if (m_mode != Fb::Code) return;
+    if (QAction *action = m_actions.value(Fb::Code)) action->setChecked(true);
+    int pos = m_sync->position(id);
+    if (pos >= 0) m_code->setPosition(pos);
+}
+
 void FbMainDock::error(int row, int col)
 {
     m_code->setCursor(row, col);
@@ -162,6 +192,14 @@ void FbMainDock::error(int row, int col)
 
 bool FbMainDock::load(const QString &filename)
 {
+    // Large files are opened in the code view without being parsed
+    QSettings settings;
+    qint64 limit = qint64(settings.value("code/large", 64).toInt()) << 20;
+    if (limit > 0 && QFileInfo(filename).size() > limit) {
+        setMode(Fb::Code);
+        if (m_code->open(filename)) return true;
+    }
+
     QFile *file = new QFile(filename);
     if (!file->open(QFile::ReadOnly | QFile::Text)) {
         qCritical() << QObject::tr("Cannot read file %1: %2.").arg(filename).arg(file->errorString());
@@ -182,8 +220,10 @@ bool FbMainDock::load(const QString &filename)
 bool FbMainDock::save(QIODevice *device, const QString &codec)
 {
     if (currentWidget() == m_code) {
+        QString xml;
+        if (!m_sync->unfold(m_code->toPlainText(), xml)) return false;
         QTextStream out(device);
-        out << m_code->toPlainText();
+        out << xml;
     } else {
         isSwitched = false;
         m_text->save(device, codec);
@@ -13,6 +13,7 @@
 class FbTextEdit;
 class FbHeadEdit;
 class FbCodeEdit;
+class FbSyncMap;
 
 class FbMainDock : public QStackedWidget
 {
@@ -33,6 +34,10 @@ public:
     void addMenu(QMenu *menu);
     bool isModified() const;
 
+public slots:
+    void showLine(int row, int col);
+    void showNode(int id);
+
 signals:
     void modificationChanged(bool changed);
     void status(const QString &text);
@@ -55,6 +60,7 @@ private:
     FbTextEdit *m_text;
     FbHeadEdit *m_head;
     FbCodeEdit *m_code;
+    FbSyncMap *m_sync;
     QToolBar *m_tool;
     bool isSwitched;
     Fb::Mode m_mode;
@@ -19,163 +19,48 @@
 #include "fb2text.hpp"
 #include "fb2utils.h"
 
-//---------------------------------------------------------------------------
-//  FbScheme::Fb
-//---------------------------------------------------------------------------
-
-FbScheme::FbDom::FbDom()
-{
-    QFile file(":/fb2/FictionBook2.1.xsd");
-    if (file.open(QIODevice::ReadOnly)) setContent(&file);
-}
-
 //---------------------------------------------------------------------------
 //  FbScheme
 //---------------------------------------------------------------------------
 
-const QDomDocument & FbScheme::fb2()
+FbScheme FbScheme::element(const QString &name) const
 {
-    static const FbDom doc;
-    return doc;
+    // Undeclared children of an untyped element share its scheme
+    const FbSchemeIndex::Node *node = FbSchemeIndex::instance().child(m_node, name);
+    if (!node && m_node && m_node->type.isEmpty()) node = m_node;
+    return FbScheme(node);
 }
 
-FB2_BEGIN_KEYHASH(FbScheme)
-    FB2_KEY( XsElement     , "xs:element"     );
-    FB2_KEY( XsChoice      , "xs:choice"      );
-    FB2_KEY( XsComplexType , "xs:complexType" );
-    FB2_KEY( XsSequence    , "xs:sequence"    );
-FB2_END_KEYHASH
-
 void FbScheme::items(QStringList &list) const
 {
-    FbScheme child = typeScheme().firstChildElement();
-    while (!child.isNull()) {
-        switch (toKeyword(child.tagName())) {
-            case XsElement: {
-                    QString name = child.attribute("name");
-                    if (!list.contains(name)) list << name;
-                } break;
-            case XsChoice:
-            case XsComplexType:
-            case XsSequence: {
-                    child.items(list);
-                } break;
-            default: ;
-        }
-        child = child.nextSiblingElement();
+    foreach (const QString &name, FbSchemeIndex::instance().items(m_node)) {
+        if (!list.contains(name)) list << name;
     }
 }
 
 bool FbScheme::canEdit() const
 {
-    if (type() == "sequenceType") return true;
-    FbScheme scheme = typeScheme();
-    FbScheme child = scheme.firstChildElement();
-    while (!child.isNull()) {
-        switch (toKeyword(child.tagName())) {
-            case XsElement:
-                return false;
-            case XsChoice:
-            case XsComplexType:
-            case XsSequence:
-                if (!child.canEdit()) return false;
-            default: ;
-        }
-        child = child.nextSiblingElement();
-    }
-    return true;
-}
-
-FbScheme FbScheme::typeScheme() const
-{
-    QString typeName = type();
-    if (typeName.isEmpty()) return *this;
-
-    FbScheme child = fb2().firstChildElement("xs:schema").firstChildElement();
-    while (!child.isNull()) {
-        if (child.tagName() == "xs:complexType") {
-            if (child.attribute("name") == typeName) return child.element(typeName);
-        }
-        child = child.nextSiblingElement();
-    }
-
-    return FbScheme();
+    return FbSchemeIndex::instance().canEdit(m_node);
 }
 
 QString FbScheme::info() const
 {
-    QDomElement element = *this;
-    if (element.isNull()) return QString();
-
-    element = element.firstChildElement("xs:annotation");
-    if (element.isNull()) return QString();
-
-    element = element.firstChildElement("xs:documentation");
-    if (element.isNull()) return QString();
-
-    return element.text();
+    return m_node ? m_node->info : QString();
 }
 
 QString FbScheme::type() const
 {
-    if (isNull()) return QString();
-    QString result = attribute("type");
-    if (!result.isEmpty()) return result;
-    FbScheme child = firstChildElement("xs:complexType").firstChildElement();
-    while (!child.isNull()) {
-        QString tag = child.tagName();
-        if (tag == "xs:complexContent" || tag == "xs:simpleContent") {
-            return child.firstChildElement("xs:extension").attribute("base");
-        }
-        child = child.nextSiblingElement();
-    }
-    return QString();
+    return m_node ? m_node->type : QString();
 }
 
-FbScheme FbScheme::item(const QString &name) const
+QString FbScheme::minOccurs() const
 {
-    FbScheme child = firstChildElement();
-    while (!child.isNull()) {
-        switch (toKeyword(child.tagName())) {
-            case XsElement: {
-                    if (child.attribute("name") == name) return child;
-                } break;
-            case XsChoice:
-            case XsComplexType:
-            case XsSequence: {
-                    FbScheme result = child.item(name);
-                    if (!result.isNull()) return result;
-                } break;
-            default: ;
-        }
-        child = child.nextSiblingElement();
-    }
-    return FbScheme();
+    return m_node ? m_node->minOccurs : QString();
 }
 
-FbScheme FbScheme::element(const QString &name) const
+QString FbScheme::maxOccurs() const
 {
-    FbScheme parent = *this;
-    if (parent.isNull()) {
-        parent = fb2().documentElement();
-        parent = parent.element("FictionBook");
-    }
-
-    FbScheme child = parent.item(name);
-    if (!child.isNull()) return child;
-
-    QString type = this->type();
-    if (type.isEmpty()) return *this;
-
-    child = fb2().firstChildElement("xs:schema").firstChildElement();
-    while (!child.isNull()) {
-        if (child.tagName() == "xs:complexType") {
-            if (child.attribute("name") == type) return child.element(name);
-        }
-        child = child.nextSiblingElement();
-    }
-
-    return FbScheme();
+    return m_node ? m_node->maxOccurs : QString();
 }
 
 //---------------------------------------------------------------------------
@@ -217,6 +102,7 @@ FbHeadItem::FbHeadItem(QWebElement &element, FbHeadItem *parent)
     : QObject(parent)
     , m_element(element)
     , m_parent(parent)
+    , m_hasScheme(false)
 {
     m_name = element.tagName().toLower();
     if (m_name.left(3) == "fb:") {
@@ -226,7 +112,11 @@ FbHeadItem::FbHeadItem(QWebElement &element, FbHeadItem *parent)
     } else if (m_name == "img") {
         m_name = "image";
     }
-    addChildren(element);
+    QList<QWebElement> list;
+    addElements(element, list);
+    for (int i = 0; i < list.count(); i++) {
+        m_list << new FbHeadItem(list[i], this);
+    }
 }
 
 FbHeadItem::~FbHeadItem()
@@ -248,17 +138,46 @@ FbHeadItem * FbHeadItem::append(const QString name)
     return child;
 }
 
-void FbHeadItem::addChildren(QWebElement &parent)
+FbHeadItem * FbHeadItem::insert(int row, QWebElement &element)
+{
+    FbHeadItem * child = new FbHeadItem(element, this);
+    m_list.insert(row, child);
+    return child;
+}
+
+void FbHeadItem::drop(int row, int count)
+{
+    // The elements are already gone from the document
+    for (int i = 0; i < count; i++) {
+        delete m_list.takeAt(row);
+    }
+}
+
+void FbHeadItem::elements(QList<QWebElement> &list) const
+{
+    if (m_name == "annotation" || m_name == "history") return;
+    addElements(m_element, list);
+}
+
+int FbHeadItem::find(const QWebElement &element, int from) const
+{
+    for (int i = from; i < m_list.count(); i++) {
+        if (m_list[i]->m_element == element) return i;
+    }
+    return -1;
+}
+
+void FbHeadItem::addElements(const QWebElement &parent, QList<QWebElement> &list)
 {
     QWebElement child = parent.firstChild();
     while (!child.isNull()) {
         QString tag = child.tagName().toLower();
         if (tag.left(3) == "fb:") {
-            m_list << new FbHeadItem(child, this);
+            list << child;
         } else if (tag == "img") {
-            m_list << new FbHeadItem(child, this);
+            list << child;
         } else {
-            addChildren(child);
+            addElements(child, list);
         }
         child = child.nextSibling();
     }
@@ -286,8 +205,8 @@ QString FbHeadItem::data(int col) const
         case 3: return scheme().info();
         case 4: return scheme().type();
         case 5: return scheme().canEdit() ? "Yes" : "No";
-        case 6: return scheme().attribute("minOccurs");
-        case 7: return scheme().attribute("maxOccurs");
+        case 6: return scheme().minOccurs();
+        case 7: return scheme().maxOccurs();
     }
     return QString();
 }
@@ -328,7 +247,7 @@ QString FbHeadItem::value() const
             return text;
         } break;
         case Image: {
-            return m_element.attribute("src");
+            return m_element.attribute("src", m_element.attribute("data-src"));
         } break;
         case Seqn: {
             return m_element.attribute("name");
@@ -389,15 +308,19 @@ QString FbHeadItem::sub(const QString &key) const
 
 FbScheme FbHeadItem::scheme() const
 {
-    FbScheme parent = m_parent ? m_parent->scheme() : FbScheme();
-    return parent.element(m_name);
+    if (!m_hasScheme) {
+        FbScheme parent = m_parent ? m_parent->scheme() : FbScheme();
+        m_scheme = parent.element(m_name);
+        m_hasScheme = true;
+    }
+    return m_scheme;
 }
 
 void FbHeadItem::remove(int row)
 {
     if (row < 0 || row >= count()) return;
     m_list[row]->m_element.removeFromDocument();
-    m_list.removeAt(row);
+    delete m_list.takeAt(row);
 }
 
 //---------------------------------------------------------------------------
@@ -409,8 +332,7 @@ FbHeadModel::FbHeadModel(QWebView &view, QObject *parent)
     , m_view(view)
     , m_root(NULL)
 {
-    QWebElement doc = view.page()->mainFrame()->documentElement();
-    QWebElement head = doc.findFirst("fb\\:description");
+    QWebElement head = description();
     if (head.isNull()) return;
     m_root = new FbHeadItem(head);
 }
@@ -420,6 +342,61 @@ FbHeadModel::~FbHeadModel()
     if (m_root) delete m_root;
 }
 
+QWebElement FbHeadModel::description() const
+{
+    QWebElement doc = m_view.page()->mainFrame()->documentElement();
+    return doc.findFirst("fb\\:description");
+}
+
+bool FbHeadModel::update()
+{
+    // Another document is loaded: the tree is built anew, otherwise
+    // only the rows that differ from the description are touched.
+    QWebElement head = description();
+    if (!m_root || head.isNull() || m_root->element() != head) {
+        beginResetModel();
+        if (m_root) delete m_root;
+        m_root = head.isNull() ? NULL : new FbHeadItem(head);
+        endResetModel();
+        return true;
+    }
+    update(m_root, index(0, 0));
+    return false;
+}
+
+void FbHeadModel::update(FbHeadItem *owner, const QModelIndex &parent)
+{
+    QList<QWebElement> list;
+    owner->elements(list);
+
+    int row = 0;
+    for (int i = 0; i < list.count(); i++, row++) {
+        int pos = owner->find(list[i], row);
+        if (pos < 0) {
+            beginInsertRows(parent, row, row);
+            owner->insert(row, list[i]);
+            endInsertRows();
+            continue;
+        }
+        if (pos > row) {
+            beginRemoveRows(parent, row, pos - 1);
+            owner->drop(row, pos - row);
+            endRemoveRows();
+        }
+        update(owner->item(row), index(row, 0, parent));
+    }
+
+    int count = owner->count();
+    if (row < count) {
+        beginRemoveRows(parent, row, count - 1);
+        owner->drop(row, count - row);
+        endRemoveRows();
+        count = row;
+    }
+
+    if (count) emit dataChanged(index(0, 0, parent), index(count - 1, columnCount(parent) - 1, parent));
+}
+
 void FbHeadModel::expand(QTreeView *view)
 {
     QModelIndex parent = QModelIndex();
@@ -557,6 +534,7 @@ bool FbHeadModel::canEdit(const QModelIndex &index) const
 FbHeadEdit::FbHeadEdit(QWidget *parent, FbTextEdit *text)
     : QTreeView(parent)
     , m_text(text)
+    , m_dirty(true)
 {
     QAction * act;
 
@@ -586,6 +564,8 @@ FbHeadEdit::FbHeadEdit(QWidget *parent, FbTextEdit *text)
     setHorizontalScrollMode(QAbstractItemView::ScrollPerPixel);
     connect(this, SIGNAL(activated(QModelIndex)), SLOT(activated(QModelIndex)));
     connect(this, SIGNAL(collapsed(QModelIndex)), SLOT(collapsed(QModelIndex)));
+    connect(text->page(), SIGNAL(loadFinished(bool)), SLOT(changeTree()));
+    connect(text->page(), SIGNAL(descriptionChanged()), SLOT(changeTree()));
 
     header()->setDefaultSectionSize(200);
 }
@@ -615,9 +595,24 @@ FbHeadModel * FbHeadEdit::model() const
 
 void FbHeadEdit::updateTree()
 {
-    FbHeadModel * model = new FbHeadModel(*m_text, this);
-    setModel(model);
-    model->expand(this);
+    // The model lives across mode switches, so expansion and
+    // selection survive; it is synchronized only after changes.
+    if (!m_dirty) return;
+    m_dirty = false;
+    FbHeadModel * m = model();
+    if (!m) {
+        m = new FbHeadModel(*m_text, this);
+        setModel(m);
+        m->expand(this);
+    } else if (m->update()) {
+        m->expand(this);
+    }
+}
+
+void FbHeadEdit::changeTree()
+{
+    m_dirty = true;
+    if (isVisible()) updateTree();
 }
 
 void FbHeadEdit::editCurrent(const QModelIndex &index)
@@ -718,7 +713,7 @@ void FbHeadModel::remove(const QModelIndex &index)
 {
     int r = index.row();
     QModelIndex p = parent(index);
-    beginRemoveRows(p, r, r + 1);
+    beginRemoveRows(p, r, r);
     FbHeadItem * i = item(p);
     if (i) i->remove(r);
     endRemoveRows();
@@ -3,8 +3,6 @@
 
 #include <QAbstractItemModel>
 #include <QDialog>
-#include <QDomDocument>
-#include <QDomElement>
 #include <QMap>
 #include <QTreeView>
 #include <QWebElement>
@@ -21,42 +19,28 @@ QT_END_NAMESPACE
 
 #include "fb2mode.h"
 #include "fb2xml.hpp"
+#include "fb2xsd.hpp"
 
 class FbTextEdit;
 
-class FbScheme : public QDomElement
+class FbScheme
 {
-    FB2_BEGIN_KEYLIST
-        XsElement,
-        XsChoice,
-        XsComplexType,
-        XsSequence,
-    FB2_END_KEYLIST
-
-private:
-    class FbDom : public QDomDocument { public: FbDom(); };
-
 public:
-    FbScheme() {}
-    FbScheme(const FbScheme &x) : QDomElement(x) {}
-    FbScheme(const QDomElement &x) : QDomElement(x) {}
-    FbScheme& operator=(const FbScheme &x) { QDomElement::operator=(x); return *this; }
-
-    void setAction(Fb::Actions index, QAction *action);
-    void connectActions();
-    void disconnectActions();
-
-    static const QDomDocument & fb2();
+    FbScheme() : m_node(0) {}
     FbScheme element(const QString &name) const;
     void items(QStringList &list) const;
     bool canEdit() const;
     QString info() const;
     QString type() const;
+    QString minOccurs() const;
+    QString maxOccurs() const;
+    bool isNull() const { return !m_node; }
 
 private:
-    FbScheme typeScheme() const;
-    FbScheme item(const QString &name) const;
-    FbActionMap m_actions;
+    explicit FbScheme(const FbSchemeIndex::Node *node) : m_node(node) {}
+
+private:
+    const FbSchemeIndex::Node *m_node;
 };
 
 class FbHeadItem: public QObject
@@ -79,8 +63,16 @@ public:
 
     FbHeadItem * append(const QString name);
 
+    FbHeadItem * insert(int row, QWebElement &element);
+
     void remove(int row);
 
+    void drop(int row, int count);
+
+    void elements(QList<QWebElement> &list) const;
+
+    int find(const QWebElement &element, int from) const;
+
     FbHeadItem * item(const QModelIndex &index) const;
 
     FbHeadItem * item(int row) const;
@@ -127,7 +119,7 @@ private:
     };
 
 private:
-    void addChildren(QWebElement &parent);
+    static void addElements(const QWebElement &parent, QList<QWebElement> &list);
     void setValue(const QString &text);
     void setExtra(const QString &text);
     QString value() const;
@@ -139,6 +131,8 @@ private:
     QWebElement m_element;
     FbHeadItem * m_parent;
     QString m_name;
+    mutable FbScheme m_scheme;
+    mutable bool m_hasScheme;
 };
 
 class FbHeadModel: public QAbstractItemModel
@@ -148,6 +142,7 @@ class FbHeadModel: public QAbstractItemModel
 public:
     explicit FbHeadModel(QWebView &view, QObject *parent = 0);
     virtual ~FbHeadModel();
+    bool update();
     void expand(QTreeView *view);
     FbHeadItem * item(const QModelIndex &index) const;
     QModelIndex append(const QModelIndex &parent, const QString &name);
@@ -164,6 +159,10 @@ public:
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
 
+private:
+    QWebElement description() const;
+    void update(FbHeadItem *owner, const QModelIndex &parent);
+
 private:
     QWebView & m_view;
     FbHeadItem * m_root;
@@ -190,6 +189,7 @@ public slots:
     void updateTree();
 
 private slots:
+    void changeTree();
     void activated(const QModelIndex &index);
     void collapsed(const QModelIndex &index);
     void appendNode();
@@ -207,6 +207,7 @@ private:
     QAction * actionModify;
     QAction * actionDelete;
     FbActionMap m_actions;
+    bool m_dirty;
 };
 
 class FbNodeDlg : public QDialog
@@ -221,7 +222,7 @@ private slots:
     void comboChanged(const QString &text);
 
 private:
-    const FbScheme &m_scheme;
+    FbScheme m_scheme;
     QComboBox * m_combo;
     QLabel * m_text;
 };
@@ -234,7 +235,7 @@ public:
     explicit FbNodeEditDlg(QWidget *parent, const FbScheme &scheme, const QWebElement &element);
 
 private:
-    const FbScheme &m_scheme;
+    FbScheme m_scheme;
     QWebElement m_element;
 };
 
@@ -1,6 +1,21 @@
 #include "fb2html.h"
+#include "fb2imgs.hpp"
+#include "fb2page.hpp"
 #include "fb2utils.h"
 #include "fb2text.hpp"
+#include "fb2xsd.hpp"
+
+#include <QWebFrame>
+
+static void notify(const QWebElement &parent)
+{
+    if (parent.isNull()) return;
+    QWebFrame *frame = parent.webFrame();
+    if (!frame) return;
+    if (FbTextPage *page = qobject_cast<FbTextPage*>(frame->page())) {
+        page->notify(parent);
+    }
+}
 
 //---------------------------------------------------------------------------
 //  FbTextElement::Scheme
@@ -8,49 +23,37 @@
 
 FbTextElement::Scheme::Scheme()
 {
-    m_types["BODY"]
-        << Type("FB:DESCRIPTION", 1, 1)
-        << Type("FB:BODY", 1, 1)
-    ;
-
-    m_types["FB:DESCRIPTION"]
-        << Type("FB:TITLE-INFO", 1, 1)
-        << Type("FB:SRC-TITLE-INFO", 0, 1)
-        << Type("FB:DOCUMENT-INFO", 1, 1)
-        << Type("FB:PUBLISH-INFO", 0, 1)
-        << Type("FB:CUSTOM-INFO")
-    ;
-
-    m_types["FB:DOCUMENT-INFO"]
-        << Type("FB:AUTHOR", 1, 1)
-        << Type("FB:PROGRAM-USED", 0, 1)
-        << Type("FB:DATE", 0, 1)
-    ;
-
-    m_types["FB:BODY"]
-        << Type("IMG")
-        << Type("FB:TITLE", 0, 1)
-        << Type("FB:EPIGRAPH")
-        << Type("FB:SECTION", 1, 0)
-    ;
-
-    m_types["FB:SECTION"]
-        << Type("FB:TITLE", 1, 0)
-        << Type("FB:EPIGRAPH")
-        << Type("IMG")
-        << Type("FB:ANNOTATION")
-        << Type("FB:SECTION")
-    ;
-
-    m_types["FB:POEM"]
-        << Type("FB:TITLE", 1, 0)
-        << Type("FB:EPIGRAPH", 0, 0)
-        << Type("FB:STANZA", 1, 0)
-    ;
-
-    m_types["FB:STANZA"]
-        << Type("FB:TITLE", 1, 0)
-    ;
+    // Child lists come from the schema index, text blocks are left out
+    static const char * table[][3] = {
+        { "BODY"             , 0             , 0               },
+        { "FB:DESCRIPTION"   , 0             , "description"   },
+        { "FB:DOCUMENT-INFO" , "description" , "document-info" },
+        { "FB:BODY"          , 0             , "body"          },
+        { "FB:SECTION"       , "body"        , "section"       },
+        { "FB:POEM"          , "section"     , "poem"          },
+        { "FB:STANZA"        , "poem"        , "stanza"        },
+    };
+
+    QStringList blocks;
+    blocks << "p" << "v" << "subtitle" << "text-author" << "empty-line";
+
+    const FbSchemeIndex &index = FbSchemeIndex::instance();
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        const FbSchemeIndex::Node *node = index.root();
+        if (table[i][1]) node = index.child(node, table[i][1]);
+        if (table[i][2]) node = index.child(node, table[i][2]);
+        if (!node) continue;
+
+        TypeList &list = m_types[table[i][0]];
+        foreach (const QString &name, index.items(node)) {
+            if (blocks.contains(name)) continue;
+            const FbSchemeIndex::Node *child = index.child(node, name);
+            QString tag = name == "image" ? "IMG" : name == "table" ? "TABLE" : "FB:" + name.toUpper();
+            QString min = child ? child->minOccurs : QString();
+            QString max = child ? child->maxOccurs : QString();
+            list << Type(tag, min.isEmpty() ? 1 : min.toInt(), max == "unbounded" ? 0 : max.isEmpty() ? 1 : max.toInt());
+        }
+    }
 }
 
 const FbTextElement::TypeList * FbTextElement::Scheme::operator[](const QString &name) const
@@ -208,8 +211,7 @@ QString FbTextElement::location()
 
 void FbTextElement::select()
 {
-    QString javascript = jScript("set_cursor.js");
-    evaluateJavaScript(javascript);
+    evaluateJavaScript("FbSetCursor(this)");
 }
 
 bool FbTextElement::hasChild(const QString &style) const
@@ -269,34 +271,152 @@ FbTextElement FbTextElement::child(int index) const
 }
 
 //---------------------------------------------------------------------------
-//  FbInsertCmd
+//  FbTextMemento
 //---------------------------------------------------------------------------
 
-FbInsertCmd::FbInsertCmd(const FbTextElement &element)
+void FbTextMemento::save(const QString &text)
+{
+    QByteArray data = text.toUtf8();
+    m_packed = data.size() > 4096;
+    m_data = m_packed ? qCompress(data) : data;
+    m_size = m_data.size();
+}
+
+void FbTextMemento::save(const QWebElement &element)
+{
+    // The removed nodes themselves are kept, native editing steps
+    // below the command still refer to them; their markup only
+    // serves to account the memory they hold.
+    m_element = element;
+    m_data.clear();
+    m_packed = false;
+    m_size = element.toOuterXml().toUtf8().size();
+}
+
+QString FbTextMemento::load() const
+{
+    return QString::fromUtf8(m_packed ? qUncompress(m_data) : m_data);
+}
+
+//---------------------------------------------------------------------------
+//  FbTextCommand
+//---------------------------------------------------------------------------
+
+FbTextCommand::FbTextCommand(const QWebElement &element)
     : QUndoCommand()
-    , m_element(element)
-    , m_parent(element.previousSibling())
-    , m_inner(false)
+    , m_memory(0)
+    , m_expired(false)
+{
+    if (QWebFrame *frame = element.webFrame()) {
+        m_page = qobject_cast<FbTextPage*>(frame->page());
+    }
+}
+
+FbTextCommand::~FbTextCommand()
+{
+    if (m_page) m_page->detach(this);
+}
+
+FbTextPage * FbTextCommand::page() const
+{
+    return m_page;
+}
+
+void FbTextCommand::account(int memory)
+{
+    if (m_page) m_page->account(memory - m_memory);
+    m_memory = memory;
+}
+
+void FbTextCommand::expire()
+{
+    release();
+    account(0);
+    m_expired = true;
+}
+
+int FbTextCommand::nodeId(const QWebElement &element) const
+{
+    // Elements are addressed by node id rather than by reference, so that
+    // commands still find them after the tree around them was changed.
+    if (element.isNull()) return -1;
+    if (element.tagName() == "BODY") return 0;
+    QString id = element.attribute("data-node");
+    if (!id.isEmpty()) return id.toInt();
+    FbStore *store = m_page ? m_page->manager()->store() : 0;
+    if (!store) return -1;
+    int result = store->newNode();
+    QWebElement(element).setAttribute("data-node", QString::number(result));
+    return result;
+}
+
+FbTextElement FbTextCommand::node(int id) const
+{
+    if (!m_page || id < 0) return FbTextElement();
+    if (id == 0) return m_page->body();
+    return m_page->doc().findFirst(QString("[data-node='%1']").arg(id));
+}
+
+FbTextElement FbTextCommand::take(int parent, int index, FbTextMemento &memento) const
+{
+    FbTextElement element = node(parent).child(index);
+    if (element.isNull()) return element;
+    FbTextElement owner = element.parent();
+    memento.save(element.takeFromDocument());
+    return owner;
+}
+
+FbTextElement FbTextCommand::restore(int parent, int index, const FbTextMemento &memento) const
 {
-    if (m_parent.isNull()) {
-        m_parent = m_element.parent();
-        m_inner = true;
+    // The original nodes go back, not a copy built from markup
+    FbTextElement owner = node(parent);
+    if (owner.isNull() || memento.element().isNull()) return FbTextElement();
+    if (index == 0) {
+        owner.prependInside(memento.element());
+        return owner.firstChild();
     }
+    FbTextElement prior = owner.child(index - 1);
+    if (prior.isNull()) return prior;
+    prior.appendOutside(memento.element());
+    return prior.nextSibling();
+}
+
+//---------------------------------------------------------------------------
+//  FbInsertCmd
+//---------------------------------------------------------------------------
+
+FbInsertCmd::FbInsertCmd(const FbTextElement &element)
+    : FbTextCommand(element)
+    , m_parent(nodeId(element.parent()))
+    , m_index(element.index())
+{
+}
+
+void FbInsertCmd::release()
+{
+    m_element.clear();
 }
 
 void FbInsertCmd::redo()
 {
-    if (m_inner) {
-        m_parent.prependInside(m_element);
+    if (expired()) return;
+    FbTextElement element;
+    if (m_element.isEmpty()) {
+        element = node(m_parent).child(m_index);
     } else {
-        m_parent.appendOutside(m_element);
+        element = restore(m_parent, m_index, m_element);
+        m_element.clear();
+        account(0);
     }
-    m_element.select();
+    notify(element.parent());
+    element.select();
 }
 
 void FbInsertCmd::undo()
 {
-    m_element.takeFromDocument();
+    if (expired()) return;
+    notify(take(m_parent, m_index, m_element));
+    account(m_element.size());
 }
 
 //---------------------------------------------------------------------------
@@ -304,29 +424,87 @@ void FbInsertCmd::undo()
 //---------------------------------------------------------------------------
 
 FbReplaceCmd::FbReplaceCmd(const FbTextElement &original, const FbTextElement &duplicate)
-    : QUndoCommand()
-    , m_original(original)
-    , m_duplicate(duplicate)
+    : FbTextCommand(duplicate)
+    , m_parent(nodeId(duplicate.parent()))
+    , m_index(duplicate.index())
     , m_update(false)
 {
+    m_original.save(original);
+    account(m_original.size());
+}
+
+void FbReplaceCmd::release()
+{
+    m_original.clear();
+    m_duplicate.clear();
 }
 
 void FbReplaceCmd::redo()
 {
+    if (expired()) return;
+    FbTextElement element;
     if (m_update) {
-        m_original.prependOutside(m_duplicate);
-        m_original.takeFromDocument();
-        m_duplicate.select();
+        take(m_parent, m_index, m_original);
+        element = restore(m_parent, m_index, m_duplicate);
+        m_duplicate.clear();
+        element.select();
     } else {
+        element = node(m_parent).child(m_index);
         m_update = true;
     }
+    account(m_original.size() + m_duplicate.size());
+    notify(element.parent());
 }
 
 void FbReplaceCmd::undo()
 {
-    m_duplicate.prependOutside(m_original);
-    m_duplicate.takeFromDocument();
-    m_original.select();
+    if (expired()) return;
+    take(m_parent, m_index, m_duplicate);
+    FbTextElement element = restore(m_parent, m_index, m_original);
+    m_original.clear();
+    account(m_original.size() + m_duplicate.size());
+    notify(element.parent());
+    element.select();
+}
+
+//---------------------------------------------------------------------------
+//  FbReplaceTextCmd
+//---------------------------------------------------------------------------
+
+FbReplaceTextCmd::FbReplaceTextCmd(const FbTextElement &body, const QString &changes)
+    : FbTextCommand(body)
+    , m_update(false)
+{
+    m_changes.save(changes);
+    account(m_changes.size());
+}
+
+void FbReplaceTextCmd::release()
+{
+    m_changes.clear();
+}
+
+void FbReplaceTextCmd::apply(int column)
+{
+    FbTextPage *page = this->page();
+    if (!page || expired()) return;
+    QString javascript = QString("FbSetParagraphs(%1,%2)").arg(m_changes.load(), QString::number(column));
+    page->mainFrame()->evaluateJavaScript(javascript);
+    page->resetIndex();
+}
+
+void FbReplaceTextCmd::redo()
+{
+    if (m_update) {
+        apply(3);
+    } else {
+        m_update = true;
+    }
+}
+
+void FbReplaceTextCmd::undo()
+{
+    apply(2);
 }
 
 //---------------------------------------------------------------------------
@@ -334,30 +512,32 @@ void FbReplaceCmd::undo()
 //---------------------------------------------------------------------------
 
 FbDeleteCmd::FbDeleteCmd(const FbTextElement &element)
-    : QUndoCommand()
-    , m_element(element)
-    , m_parent(element.previousSibling())
-    , m_inner(false)
+    : FbTextCommand(element)
+    , m_parent(nodeId(element.parent()))
+    , m_index(element.index())
 {
-    if (m_parent.isNull()) {
-        m_parent = element.parent();
-        m_inner = true;
-    }
+}
+
+void FbDeleteCmd::release()
+{
+    m_element.clear();
 }
 
 void FbDeleteCmd::redo()
 {
-    m_element.takeFromDocument();
+    if (expired()) return;
+    notify(take(m_parent, m_index, m_element));
+    account(m_element.size());
 }
 
 void FbDeleteCmd::undo()
 {
-    if (m_inner) {
-        m_parent.prependInside(m_element);
-    } else {
-        m_parent.appendOutside(m_element);
-    }
-    m_element.select();
+    if (expired()) return;
+    FbTextElement element = restore(m_parent, m_index, m_element);
+    m_element.clear();
+    account(0);
+    notify(element.parent());
+    element.select();
 }
 
 //---------------------------------------------------------------------------
@@ -365,48 +545,63 @@ void FbDeleteCmd::undo()
 //---------------------------------------------------------------------------
 
 FbMoveUpCmd::FbMoveUpCmd(const FbTextElement &element)
-    : QUndoCommand()
-    , m_element(element)
+    : FbTextCommand(element)
+    , m_element(nodeId(element))
 {
 }
 
 void FbMoveUpCmd::redo()
 {
-    FbTextElement subling = m_element.previousSibling();
-    subling.prependOutside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    if (expired() || element.isNull()) return;
+    FbTextElement subling = element.previousSibling();
+    subling.prependOutside(element.takeFromDocument());
+    notify(element.parent());
 }
 
 void FbMoveUpCmd::undo()
 {
-    FbTextElement subling = m_element.nextSibling();
-    subling.appendOutside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    if (expired() || element.isNull()) return;
+    FbTextElement subling = element.nextSibling();
+    subling.appendOutside(element.takeFromDocument());
+    notify(element.parent());
 }
 
-
 //---------------------------------------------------------------------------
 //  FbMoveLeftCmd
 //---------------------------------------------------------------------------
 
 FbMoveLeftCmd::FbMoveLeftCmd(const FbTextElement &element)
-    : QUndoCommand()
-    , m_element(element)
-    , m_subling(element.previousSibling())
-    , m_parent(element.parent())
+    : FbTextCommand(element)
+    , m_element(nodeId(element))
+    , m_subling(nodeId(element.previousSibling()))
+    , m_parent(nodeId(element.parent()))
 {
 }
 
 void FbMoveLeftCmd::redo()
 {
-    m_parent.appendOutside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    FbTextElement parent = node(m_parent);
+    if (expired() || element.isNull() || parent.isNull()) return;
+    parent.appendOutside(element.takeFromDocument());
+    notify(parent);
+    notify(parent.parent());
 }
 
 void FbMoveLeftCmd::undo()
 {
-    if (m_subling.isNull()) {
-        m_parent.prependInside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    FbTextElement parent = node(m_parent);
+    if (expired() || element.isNull() || parent.isNull()) return;
+    if (m_subling < 0) {
+        parent.prependInside(element.takeFromDocument());
     } else {
-        m_subling.appendOutside(m_element.takeFromDocument());
+        node(m_subling).appendOutside(element.takeFromDocument());
     }
+    notify(parent.parent());
+    notify(parent);
 }
 
 //---------------------------------------------------------------------------
@@ -414,18 +609,28 @@ void FbMoveLeftCmd::undo()
 //---------------------------------------------------------------------------
 
 FbMoveRightCmd::FbMoveRightCmd(const FbTextElement &element)
-    : QUndoCommand()
-    , m_element(element)
-    , m_subling(element.previousSibling())
+    : FbTextCommand(element)
+    , m_element(nodeId(element))
+    , m_subling(nodeId(element.previousSibling()))
 {
 }
 
 void FbMoveRightCmd::redo()
 {
-    m_subling.appendInside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    FbTextElement subling = node(m_subling);
+    if (expired() || element.isNull() || subling.isNull()) return;
+    subling.appendInside(element.takeFromDocument());
+    notify(subling.parent());
+    notify(subling);
 }
 
 void FbMoveRightCmd::undo()
 {
-    m_subling.appendOutside(m_element.takeFromDocument());
+    FbTextElement element = node(m_element);
+    FbTextElement subling = node(m_subling);
+    if (expired() || element.isNull() || subling.isNull()) return;
+    subling.appendOutside(element.takeFromDocument());
+    notify(subling);
+    notify(subling.parent());
 }
@@ -1,6 +1,7 @@
 #ifndef FB2HTML_H
 #define FB2HTML_H
 
+#include <QPointer>
 #include <QUndoCommand>
 #include <QWebElement>
 
@@ -93,73 +94,136 @@ private:
     TypeList::const_iterator subtype(const TypeList &list, const QString &style);
 };
 
-class FbInsertCmd : public QUndoCommand
+class FbTextMemento
+{
+public:
+    FbTextMemento() : m_packed(false), m_size(0) {}
+    void save(const QString &text);
+    void save(const QWebElement &element);
+    QString load() const;
+    const QWebElement & element() const { return m_element; }
+    void clear() { m_data.clear(); m_element = QWebElement(); m_packed = false; m_size = 0; }
+    bool isEmpty() const { return m_data.isEmpty() && m_element.isNull(); }
+    int size() const { return m_size; }
+private:
+    QWebElement m_element;
+    QByteArray m_data;
+    bool m_packed;
+    int m_size;
+};
+
+class FbTextCommand : public QUndoCommand
+{
+public:
+    explicit FbTextCommand(const QWebElement &element);
+    virtual ~FbTextCommand();
+    int memory() const { return m_memory; }
+    void expire();
+protected:
+    virtual void release() {}
+    bool expired() const { return m_expired; }
+    void account(int memory);
+    FbTextPage * page() const;
+    int nodeId(const QWebElement &element) const;
+    FbTextElement node(int id) const;
+    FbTextElement take(int parent, int index, FbTextMemento &memento) const;
+    FbTextElement restore(int parent, int index, const FbTextMemento &memento) const;
+private:
+    QPointer<FbTextPage> m_page;
+    int m_memory;
+    bool m_expired;
+};
+
+class FbInsertCmd : public FbTextCommand
 {
 public:
     explicit FbInsertCmd(const FbTextElement &element);
     virtual void undo();
     virtual void redo();
+protected:
+    virtual void release();
 private:
-    FbTextElement m_element;
-    FbTextElement m_parent;
-    bool m_inner;
+    FbTextMemento m_element;
+    int m_parent;
+    int m_index;
 };
 
-class FbReplaceCmd : public QUndoCommand
+class FbReplaceCmd : public FbTextCommand
 {
 public:
     explicit FbReplaceCmd(const FbTextElement &original, const FbTextElement &duplicate);
     virtual void undo();
     virtual void redo();
+protected:
+    virtual void release();
+private:
+    FbTextMemento m_original;
+    FbTextMemento m_duplicate;
+    int m_parent;
+    int m_index;
+    bool m_update;
+};
+
+class FbReplaceTextCmd : public FbTextCommand
+{
+public:
+    explicit FbReplaceTextCmd(const FbTextElement &body, const QString &changes);
+    virtual void undo();
+    virtual void redo();
+protected:
+    virtual void release();
+private:
+    void apply(int column);
 private:
-    FbTextElement m_original;
-    FbTextElement m_duplicate;
+    FbTextMemento m_changes;
     bool m_update;
 };
 
-class FbDeleteCmd : public QUndoCommand
+class FbDeleteCmd : public FbTextCommand
 {
 public:
     explicit FbDeleteCmd(const FbTextElement &element);
     virtual void undo();
     virtual void redo();
+protected:
+    virtual void release();
 private:
-    FbTextElement m_element;
-    FbTextElement m_parent;
-    bool m_inner;
+    FbTextMemento m_element;
+    int m_parent;
+    int m_index;
 };
 
-class FbMoveUpCmd : public QUndoCommand
+class FbMoveUpCmd : public FbTextCommand
 {
 public:
     explicit FbMoveUpCmd(const FbTextElement &element);
     virtual void undo();
     virtual void redo();
 private:
-    FbTextElement m_element;
+    int m_element;
 };
 
-class FbMoveLeftCmd : public QUndoCommand
+class FbMoveLeftCmd : public FbTextCommand
 {
 public:
     explicit FbMoveLeftCmd(const FbTextElement &element);
     virtual void undo();
     virtual void redo();
 private:
-    FbTextElement m_element;
-    FbTextElement m_subling;
-    FbTextElement m_parent;
+    int m_element;
+    int m_subling;
+    int m_parent;
 };
 
-class FbMoveRightCmd : public QUndoCommand
+class FbMoveRightCmd : public FbTextCommand
 {
 public:
     explicit FbMoveRightCmd(const FbTextElement &element);
     virtual void undo();
     virtual void redo();
 private:
-    FbTextElement m_element;
-    FbTextElement m_subling;
+    int m_element;
+    int m_subling;
 };
 
 #endif // FB2HTML_H
@@ -2,50 +2,80 @@
 
 #include <QAbstractListModel>
 #include <QBuffer>
+#include <QCache>
+#include <QCheckBox>
 #include <QCryptographicHash>
 #include <QDialogButtonBox>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QFormLayout>
 #include <QImageReader>
+#include <QImageWriter>
 #include <QLabel>
 #include <QLineEdit>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QRunnable>
+#include <QSet>
+#include <QSpinBox>
 #include <QSplitter>
+#include <QThreadPool>
 #include <QUrl>
 #include <QVBoxLayout>
 #include <QWebFrame>
+#include <QWebSettings>
 #include <QTabWidget>
 #include <QtDebug>
 
 #include "fb2list.hpp"
 #include "fb2page.hpp"
+#include "fb2srch.hpp"
+#include "fb2stat.hpp"
 #include "fb2text.hpp"
 #include "fb2utils.h"
 
-static QString imgHtml(const QUrl &url)
-{
-    return QString("<img src=\"%1\" valign=center align=center width=100%>").arg(url.toString());
-}
-
 //---------------------------------------------------------------------------
 //  FbBinary
+//
+//    Pictures smaller than FB2_SPILL_SIZE stay in memory, only the large
+//    ones are spilled to their own temporary file.
 //---------------------------------------------------------------------------
 
+#define FB2_SPILL_SIZE (64 * 1024)
+
 FbBinary::FbBinary(const QString &name)
-    : QTemporaryFile()
+    : QObject()
     , m_name(name)
+    , m_file(0)
     , m_size(0)
 {
 }
 
+FbBinary::~FbBinary()
+{
+    if (m_file) delete m_file;
+}
+
 qint64 FbBinary::write(QByteArray &data)
 {
-    open();
     if (m_hash.isEmpty()) m_hash = md5(data);
-    m_size = QTemporaryFile::write(data);
     QBuffer buffer(&data);
     buffer.open(QIODevice::ReadOnly);
     m_type = QImageReader::imageFormat(&buffer);
-    close();
+
+    if (data.size() < FB2_SPILL_SIZE) {
+        if (m_file) delete m_file;
+        m_file = 0;
+        m_data = data;
+        return m_size = data.size();
+    }
+
+    m_data.clear();
+    if (!m_file) m_file = new QTemporaryFile();
+    m_file->open();
+    m_file->resize(0);
+    m_size = m_file->write(data);
+    m_file->close();
     return m_size;
 }
 
@@ -56,18 +86,116 @@ QString FbBinary::md5(const QByteArray &data)
 
 QByteArray FbBinary::data()
 {
-    open();
-    QByteArray data = readAll();
-    close();
+    if (!m_file) return m_data;
+    m_file->open();
+    QByteArray data = m_file->readAll();
+    m_file->close();
     return data;
 }
 
+//---------------------------------------------------------------------------
+//  FbImageTask
+//---------------------------------------------------------------------------
+
+class FbImageTask : public QRunnable
+{
+public:
+    explicit FbImageTask(const FbImageOptions &options, const QByteArray &data, QAtomicInt &done)
+        : m_options(options), m_data(data), m_done(done) { setAutoDelete(false); }
+    const QByteArray & result() const { return m_result; }
+    virtual void run();
+private:
+    void optimize();
+    static bool isPhoto(const QImage &image);
+    static QByteArray encode(const QImage &image, const QByteArray &format, int quality);
+private:
+    const FbImageOptions m_options;
+    const QByteArray m_data;
+    QAtomicInt &m_done;
+    QByteArray m_result;
+};
+
+void FbImageTask::run()
+{
+    optimize();
+    m_done.ref();
+}
+
+void FbImageTask::optimize()
+{
+    QByteArray data = m_data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    QByteArray format = reader.format().toLower();
+    if (format != "jpeg" && format != "png") return;
+
+    QImage image;
+    if (!reader.read(&image)) return;
+
+    int limit = m_options.maxSize;
+    if (limit > 0 && (image.width() > limit || image.height() > limit)) {
+        image = image.scaled(limit, limit, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    if (format == "png" && m_options.convert && isPhoto(image)) {
+        image = image.convertToFormat(QImage::Format_RGB32);
+        format = "jpeg";
+    }
+
+    // Re-encoding never carries EXIF or text chunks over, so every
+    // result we keep is stripped of the original metadata.
+    int quality = format == "jpeg" ? m_options.quality : -1;
+    QByteArray result = encode(image, format, quality);
+    if (format == "jpeg" && m_options.maxBytes > 0) {
+        while (result.size() > m_options.maxBytes && quality > 40) {
+            quality -= 10;
+            result = encode(image, format, quality);
+        }
+    }
+
+    if (!result.isEmpty() && result.size() < m_data.size()) m_result = result;
+}
+
+bool FbImageTask::isPhoto(const QImage &image)
+{
+    if (image.hasAlphaChannel()) return false;
+    if (image.colorCount()) return false;
+
+    int w = image.width();
+    int h = image.height();
+    int dx = qMax(1, w / 64);
+    int dy = qMax(1, h / 64);
+    QSet<QRgb> colors;
+    for (int y = 0; y < h; y += dy) {
+        for (int x = 0; x < w; x += dx) {
+            colors.insert(image.pixel(x, y));
+            if (colors.count() > 256) return true;
+        }
+    }
+    return false;
+}
+
+QByteArray FbImageTask::encode(const QImage &image, const QByteArray &format, int quality)
+{
+    QByteArray result;
+    QBuffer buffer(&result);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, format);
+    if (quality >= 0) writer.setQuality(quality);
+    if (!writer.write(image)) return QByteArray();
+    return result;
+}
+
 //---------------------------------------------------------------------------
 //  FbStore
 //---------------------------------------------------------------------------
 
 FbStore::FbStore(QObject *parent)
     : QObject(parent)
+    , m_index(new FbTextIndex)
+    , m_stats(new FbTextStats)
+    , m_nodes(0)
 {
 }
 
@@ -75,6 +203,8 @@ FbStore::~FbStore()
 {
     FbTemporaryIterator it(*this);
     while (it.hasNext()) delete it.next();
+    delete m_index;
+    delete m_stats;
 }
 
 void FbStore::binary(const QString &name, const QByteArray &data)
@@ -159,6 +289,157 @@ bool FbStore::exists(const QString &name) const
     return false;
 }
 
+//---------------------------------------------------------------------------
+//  FbImageThread
+//
+//    The pictures are copied out of the store before the thread starts,
+//    the pool encodes them while the GUI stays responsive and reports
+//    how many are done; the result comes back as flat (name, data)
+//    tuples of the pictures that became smaller.
+//---------------------------------------------------------------------------
+
+FbImageThread * FbImageThread::execute(QObject *parent, FbStore *store, const FbImageOptions &options)
+{
+    FbImageThread *thread = new FbImageThread(parent, store, options);
+    connect(thread, SIGNAL(progress(int,int)), parent, SLOT(optimizing(int,int)));
+    connect(thread, SIGNAL(optimized(QVariantList)), parent, SLOT(optimized(QVariantList)));
+    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    thread->start();
+    return thread;
+}
+
+FbImageThread::FbImageThread(QObject *parent, FbStore *store, const FbImageOptions &options)
+    : QThread(parent)
+    , m_store(store)
+    , m_options(options)
+    , m_cancel(false)
+{
+    FbTemporaryIterator it(*store);
+    while (it.hasNext()) {
+        FbBinary *binary = it.next();
+        m_names << binary->name();
+        m_data << binary->data();
+    }
+}
+
+FbImageThread::~FbImageThread()
+{
+    cancel();
+    wait();
+}
+
+void FbImageThread::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker);
+    m_cancel = true;
+}
+
+bool FbImageThread::isCancelled()
+{
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker);
+    return m_cancel;
+}
+
+void FbImageThread::run()
+{
+    QAtomicInt done;
+    QThreadPool pool;
+    QList<FbImageTask*> tasks;
+    for (int i = 0; i < m_data.count(); i++) {
+        FbImageTask *task = new FbImageTask(m_options, m_data.at(i), done);
+        tasks.append(task);
+        pool.start(task);
+    }
+
+    int total = tasks.count();
+    emit progress(0, total);
+    while (!pool.waitForDone(100)) {
+        if (isCancelled()) {
+            pool.clear();
+            pool.waitForDone();
+            break;
+        }
+        emit progress(done.load(), total);
+    }
+
+    QVariantList result;
+    for (int i = 0; i < tasks.count(); i++) {
+        FbImageTask *task = tasks.at(i);
+        if (!task->result().isEmpty()) result << m_names.at(i) << task->result();
+        delete task;
+    }
+    if (isCancelled()) return;
+    emit progress(total, total);
+    emit optimized(result);
+}
+
+//---------------------------------------------------------------------------
+//  FbImageCache
+//---------------------------------------------------------------------------
+
+QImage FbImageCache::image(FbBinary *binary, const QSize &size)
+{
+    static QCache<QString, QImage> cache(64 * 1024);
+
+    QString key = QString("%1/%2x%3").arg(binary->hash()).arg(size.width()).arg(size.height());
+    if (QImage *image = cache.object(key)) return *image;
+
+    QByteArray data = binary->data();
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    QSize scaled = reader.size();
+    if (scaled.isValid() && (scaled.width() > size.width() || scaled.height() > size.height())) {
+        scaled.scale(size, Qt::KeepAspectRatio);
+        reader.setScaledSize(scaled);
+    }
+
+    QImage image = reader.read();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    qint64 bytes = image.sizeInBytes();
+#else
+    qint64 bytes = image.byteCount();
+#endif
+    if (!image.isNull()) cache.insert(key, new QImage(image), int(qMax<qint64>(1, bytes / 1024)));
+    return image;
+}
+
+//---------------------------------------------------------------------------
+//  FbImageCmd
+//---------------------------------------------------------------------------
+
+FbImageCmd::FbImageCmd(FbStore *store, const FbBinaryMap &data)
+    : QUndoCommand()
+    , m_store(store)
+    , m_data(data)
+{
+}
+
+void FbImageCmd::undo()
+{
+    swap();
+}
+
+void FbImageCmd::redo()
+{
+    swap();
+}
+
+void FbImageCmd::swap()
+{
+    if (!m_store) return;
+    QMutableMapIterator<QString, QByteArray> it(m_data);
+    while (it.hasNext()) {
+        it.next();
+        QByteArray data = m_store->data(it.key());
+        m_store->set(it.key(), it.value());
+        it.setValue(data);
+    }
+    QWebSettings::clearMemoryCaches();
+}
+
 #if 0
 
 //---------------------------------------------------------------------------
@@ -266,6 +547,72 @@ QByteArray FbNetworkAccessManager::data(int index) const
     return QByteArray();
 }
 
+//---------------------------------------------------------------------------
+//  FbImageView
+//---------------------------------------------------------------------------
+
+FbImageView::FbImageView(QWidget *parent)
+    : QWidget(parent)
+    , m_manager(0)
+{
+    setBackgroundRole(QPalette::Base);
+    setAutoFillBackground(true);
+}
+
+void FbImageView::setImage(FbNetworkAccessManager *manager, const QString &name)
+{
+    m_manager = manager;
+    m_name = name;
+    m_image = QImage();
+    update();
+}
+
+void FbImageView::setFile(const QString &path)
+{
+    m_manager = 0;
+    m_name.clear();
+    QImageReader reader(path);
+    QSize size = reader.size();
+    if (size.isValid() && (size.width() > 1024 || size.height() > 1024)) {
+        size.scale(1024, 1024, Qt::KeepAspectRatio);
+        reader.setScaledSize(size);
+    }
+    m_image = reader.read();
+    update();
+}
+
+void FbImageView::clear()
+{
+    m_manager = 0;
+    m_name.clear();
+    m_image = QImage();
+    update();
+}
+
+void FbImageView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QImage image = m_image;
+    if (m_manager && !m_name.isEmpty()) {
+        if (FbBinary *binary = m_manager->get(m_name)) {
+            // Round the box up, so that resizing the dock reuses cached images.
+            QSize box((width() + 63) & ~63, (height() + 63) & ~63);
+            image = FbImageCache::image(binary, box);
+        }
+    }
+    if (image.isNull()) return;
+
+    QSize size = image.size();
+    if (size.width() > width() || size.height() > height()) size.scale(this->size(), Qt::KeepAspectRatio);
+    QRect target(QPoint(0, 0), size);
+    target.moveCenter(rect().center());
+
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(target, image);
+}
+
 //---------------------------------------------------------------------------
 //  FbComboCtrl
 //---------------------------------------------------------------------------
@@ -326,7 +673,7 @@ FbImageDlg::FbTab::FbTab(QWidget* parent, QAbstractItemModel *model)
     frame->setMinimumSize(QSize(300, 200));
     layout->addWidget(frame, 1, 0, 1, 2);
 
-    preview = new QWebView(this);
+    preview = new FbImageView(this);
     frame->layout()->addWidget(preview);
 }
 
@@ -358,7 +705,6 @@ FbImageDlg::FbImageDlg(FbTextEdit *text)
 
     tabFile = new FbTab(notebook);
     tabFile->edit->setIcon(FbIcon("document-open"));
-    tabFile->preview->setHtml(QString());
     connect(tabFile->edit, SIGNAL(textChanged(QString)), SLOT(filenameChanged(QString)));
     connect(tabFile->edit, SIGNAL(popup()), SLOT(selectFile()));
     notebook->addTab(tabFile, tr("Select file"));
@@ -367,8 +713,6 @@ FbImageDlg::FbImageDlg(FbTextEdit *text)
         FbImgsModel *model = new FbImgsModel(text, this);
         tabPict = new FbTab(notebook, model);
         tabPict->combo->setCurrentIndex(0);
-        tabPict->preview->setHtml(QString(), text->url());
-        tabPict->preview->page()->setNetworkAccessManager(text->page()->networkAccessManager());
         notebook->addTab(tabPict, tr("From collection"));
         connect(tabPict->combo, SIGNAL(activated(QString)), SLOT(pictureActivated(QString)));
     }
@@ -402,23 +746,15 @@ void FbImageDlg::selectFile()
 void FbImageDlg::filenameChanged(const QString & text)
 {
     if (QFileInfo(text).exists()) {
-        QUrl url = QUrl::fromLocalFile(text);
-        preview(tabFile->preview, url);
+        tabFile->preview->setFile(text);
     } else {
-        tabFile->preview->setHtml(QString());
+        tabFile->preview->clear();
     }
 }
 
 void FbImageDlg::pictureActivated(const QString & text)
 {
-    QUrl url = tabPict->preview->url();
-    url.setFragment(text);
-    preview(tabPict->preview, url);
-}
-
-void FbImageDlg::preview(QWebView *preview, const QUrl &url)
-{
-    preview->setHtml(imgHtml(url), preview->url());
+    tabPict->preview->setImage(owner->page()->manager(), text);
 }
 
 QString FbImageDlg::result() const
@@ -438,6 +774,68 @@ QString FbImageDlg::result() const
     return QString();
 }
 
+//---------------------------------------------------------------------------
+//  FbOptimizeDlg
+//---------------------------------------------------------------------------
+
+FbOptimizeDlg::FbOptimizeDlg(QWidget *parent)
+    : QDialog(parent)
+{
+    setWindowTitle(tr("Optimize images"));
+
+    FbImageOptions defaults;
+    QFormLayout *form = new QFormLayout;
+
+    m_quality = new QSpinBox(this);
+    m_quality->setRange(10, 100);
+    m_quality->setSuffix(" %");
+    m_quality->setValue(defaults.quality);
+    form->addRow(tr("JPEG quality:"), m_quality);
+
+    m_maxSize = new QSpinBox(this);
+    m_maxSize->setRange(0, 10000);
+    m_maxSize->setSuffix(" px");
+    m_maxSize->setSpecialValueText(tr("No limit"));
+    m_maxSize->setValue(defaults.maxSize);
+    form->addRow(tr("Maximum dimension:"), m_maxSize);
+
+    m_maxBytes = new QSpinBox(this);
+    m_maxBytes->setRange(0, 10240);
+    m_maxBytes->setSuffix(" KB");
+    m_maxBytes->setSpecialValueText(tr("No limit"));
+    m_maxBytes->setValue(defaults.maxBytes / 1024);
+    form->addRow(tr("Target JPEG size:"), m_maxBytes);
+
+    m_convert = new QCheckBox(tr("Convert photographic PNG to JPEG"), this);
+    m_convert->setChecked(defaults.convert);
+    form->addRow(m_convert);
+
+    m_dryrun = new QCheckBox(tr("Dry run (report only)"), this);
+    m_dryrun->setChecked(defaults.dryrun);
+    form->addRow(m_dryrun);
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(this);
+    buttons->setOrientation(Qt::Horizontal);
+    buttons->setStandardButtons(QDialogButtonBox::Cancel|QDialogButtonBox::Ok);
+    connect(buttons, SIGNAL(accepted()), SLOT(accept()));
+    connect(buttons, SIGNAL(rejected()), SLOT(reject()));
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addLayout(form);
+    layout->addWidget(buttons);
+}
+
+FbImageOptions FbOptimizeDlg::options() const
+{
+    FbImageOptions options;
+    options.quality = m_quality->value();
+    options.maxSize = m_maxSize->value();
+    options.maxBytes = m_maxBytes->value() * 1024;
+    options.convert = m_convert->isChecked();
+    options.dryrun = m_dryrun->isChecked();
+    return options;
+}
+
 //---------------------------------------------------------------------------
 //  FbImgsModel
 //---------------------------------------------------------------------------
@@ -509,8 +907,7 @@ FbImgsWidget::FbImgsWidget(FbTextEdit *text, QWidget* parent)
     FbTextFrame *frame = new FbTextFrame(splitter);
     splitter->addWidget(frame);
 
-    m_view = new FbTextBase(frame);
-    m_view->page()->setNetworkAccessManager(text->page()->networkAccessManager());
+    m_view = new FbImageView(frame);
     frame->layout()->addWidget(m_view);
 
     splitter->setSizes(QList<int>() << 100 << 100);
@@ -525,7 +922,7 @@ FbImgsWidget::FbImgsWidget(FbTextEdit *text, QWidget* parent)
 void FbImgsWidget::loadFinished()
 {
     if (QAbstractItemModel *m = m_list->model()) m->deleteLater();
-    m_view->load(QUrl());
+    m_view->clear();
     m_list->setModel(new FbImgsModel(m_text, this));
     m_list->reset();
     m_list->resizeColumnToContents(1);
@@ -536,8 +933,6 @@ void FbImgsWidget::loadFinished()
 
 void FbImgsWidget::showCurrent(const QString &name)
 {
-    QUrl url = m_text->url();
-    url.setFragment(name);
-    m_view->setHtml(imgHtml(url));
+    m_view->setImage(m_text->page()->manager(), name);
 }
 
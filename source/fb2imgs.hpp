@@ -2,31 +2,48 @@
 #define FB2IMGS_H
 
 #include <QByteArray>
+#include <QAtomicInt>
 #include <QDialog>
 #include <QComboBox>
+#include <QImage>
 #include <QLabel>
 #include <QLineEdit>
 #include <QList>
+#include <QMap>
+#include <QMutex>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QPointer>
 #include <QString>
+#include <QStringList>
 #include <QTemporaryFile>
+#include <QThread>
 #include <QToolButton>
 #include <QTreeView>
+#include <QUndoCommand>
+#include <QVariantList>
 #include <QVBoxLayout>
 #include <QWebView>
 
+QT_BEGIN_NAMESPACE
+class QCheckBox;
+class QSpinBox;
+QT_END_NAMESPACE
+
 class FbTextEdit;
+class FbTextIndex;
+class FbTextStats;
 
 class FbNetworkAccessManager;
 
-class FbBinary : public QTemporaryFile
+class FbBinary : public QObject
 {
     Q_OBJECT
 public:
     static QString md5(const QByteArray &data);
 public:
     explicit FbBinary(const QString &name);
+    virtual ~FbBinary();
     inline qint64 write(QByteArray &data);
     void setHash(const QString &hash) { m_hash = hash; }
     const QString & hash() const { return m_hash; }
@@ -38,11 +55,27 @@ private:
     const QString m_name;
     QString m_hash;
     QString m_type;
+    QByteArray m_data;
+    QTemporaryFile *m_file;
     qint64 m_size;
 };
 
 typedef QList<FbBinary*> FbBinatyList;
 
+typedef QMap<QString, QByteArray> FbBinaryMap;
+
+class FbImageOptions
+{
+public:
+    FbImageOptions()
+        : quality(85), maxSize(1600), maxBytes(0), convert(true), dryrun(true) {}
+    int quality;
+    int maxSize;
+    int maxBytes;
+    bool convert;
+    bool dryrun;
+};
+
 class FbStore : public QObject, private FbBinatyList
 {
     Q_OBJECT
@@ -55,6 +88,14 @@ public:
     const QString & set(const QString &name, QByteArray data, const QString &hash = QString());
     QString name(const QString &hash) const;
     QByteArray data(const QString &name) const;
+    void setFragments(const QStringList &list) { m_fragments = list; }
+    const QStringList & fragments() const { return m_fragments; }
+    QString fragment(int index) const { return m_fragments.value(index); }
+    void setNodes(int count) { m_nodes = count; }
+    int nodes() const { return m_nodes; }
+    int newNode() { return ++m_nodes; }
+    FbTextIndex & index() { return *m_index; }
+    FbTextStats & stats() { return *m_stats; }
 public slots:
     void binary(const QString &name, const QByteArray &data);
 public:
@@ -62,10 +103,67 @@ public:
     inline int count() const { return FbBinatyList::count(); }
 private:
     QString newName(const QString &path);
+private:
+    QStringList m_fragments;
+    FbTextIndex *m_index;
+    FbTextStats *m_stats;
+    int m_nodes;
 };
 
 typedef QListIterator<FbBinary*> FbTemporaryIterator;
 
+class FbImageThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    static FbImageThread * execute(QObject *parent, FbStore *store, const FbImageOptions &options);
+    ~FbImageThread();
+    bool isCancelled();
+    FbStore * store() const { return m_store; }
+    const FbImageOptions & options() const { return m_options; }
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(int done, int total);
+    void optimized(const QVariantList &result);
+
+protected:
+    void run();
+
+private:
+    explicit FbImageThread(QObject *parent, FbStore *store, const FbImageOptions &options);
+
+private:
+    QPointer<FbStore> m_store;
+    const FbImageOptions m_options;
+    QStringList m_names;
+    QList<QByteArray> m_data;
+    QMutex m_mutex;
+    bool m_cancel;
+};
+
+class FbImageCache
+{
+public:
+    static QImage image(FbBinary *binary, const QSize &size);
+};
+
+class FbImageCmd : public QUndoCommand
+{
+public:
+    explicit FbImageCmd(FbStore *store, const FbBinaryMap &data);
+    virtual void undo();
+    virtual void redo();
+private:
+    void swap();
+private:
+    QPointer<FbStore> m_store;
+    FbBinaryMap m_data;
+};
+
 #if 0
 
 class FbNetworkDiskCache : public QNetworkDiskCache
@@ -120,6 +218,22 @@ private:
     qint64 offset;
 };
 
+class FbImageView : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit FbImageView(QWidget *parent = 0);
+    void setImage(FbNetworkAccessManager *manager, const QString &name);
+    void setFile(const QString &path);
+    void clear();
+protected:
+    void paintEvent(QPaintEvent *event);
+private:
+    FbNetworkAccessManager *m_manager;
+    QString m_name;
+    QImage m_image;
+};
+
 class FbComboCtrl : public QLineEdit
 {
     Q_OBJECT
@@ -146,7 +260,7 @@ private:
         QLabel *label;
         QComboBox *combo;
         FbComboCtrl *edit;
-        QWebView *preview;
+        FbImageView *preview;
     };
 
 public:
@@ -159,10 +273,6 @@ private slots:
     void notebookChanged(int index);
     void selectFile();
 
-private:
-    void preview(QWebView *preview, const QUrl &url);
-    void clear(QWebView *preview);
-
 private:
     FbTextEdit *owner;
     QTabWidget *notebook;
@@ -170,6 +280,22 @@ private:
     FbTab *tabPict;
 };
 
+class FbOptimizeDlg : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit FbOptimizeDlg(QWidget *parent = 0);
+    FbImageOptions options() const;
+
+private:
+    QSpinBox *m_quality;
+    QSpinBox *m_maxSize;
+    QSpinBox *m_maxBytes;
+    QCheckBox *m_convert;
+    QCheckBox *m_dryrun;
+};
+
 class FbImgsModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -204,7 +330,7 @@ private slots:
 private:
     FbTextEdit *m_text;
     QTreeView *m_list;
-    QWebView *m_view;
+    FbImageView *m_view;
 };
 
 #endif // FB2IMGS_H
@@ -1,7 +1,94 @@
 #include "fb2logs.hpp"
 
+#include <QSettings>
+
 #include "fb2utils.h"
 
+// Batches of collected messages are sent to the log at this interval
+#define FB2_LOG_INTERVAL 250
+
+//---------------------------------------------------------------------------
+//  FbLogBuffer
+//---------------------------------------------------------------------------
+
+FbLogBuffer::FbLogBuffer(QObject *parent)
+    : QObject(parent)
+    , m_failed(false)
+{
+    m_timer.start();
+}
+
+QString FbLogBuffer::key(QtMsgType type, const QString &msg)
+{
+    // Messages differing in numbers only, such as line references
+    // of the parser, are counted as the same message.
+    QString result = msg.simplified();
+    for (int i = 0; i < result.length(); i++) {
+        if (result.at(i).isDigit()) result[i] = '#';
+    }
+    return QString::number(type) + result;
+}
+
+void FbLogBuffer::add(QtMsgType type, int row, int col, const QString &msg)
+{
+    QString text = msg.simplified();
+    QString id = key(type, text);
+    QHash<QString, int>::const_iterator it = m_keys.find(id);
+    if (it == m_keys.constEnd()) {
+        Entry entry;
+        entry.type = type;
+        entry.msg = text;
+        entry.count = 0;
+        entry.row = row;
+        entry.col = col;
+        it = m_keys.insert(id, m_entries.count());
+        m_entries.append(entry);
+    }
+    Entry &entry = m_entries[it.value()];
+    if (entry.count == 0) m_dirty.append(it.value());
+    entry.count++;
+    entry.lastRow = row;
+    entry.lastCol = col;
+    if (m_timer.elapsed() > FB2_LOG_INTERVAL) flush();
+}
+
+void FbLogBuffer::flush()
+{
+    // Every entry goes with the count gathered since the last batch
+    m_timer.restart();
+    if (m_dirty.isEmpty()) return;
+    QVariantList list;
+    foreach (int index, m_dirty) {
+        Entry &entry = m_entries[index];
+        list << int(entry.type) << entry.msg << entry.count;
+        list << entry.row << entry.col << entry.lastRow << entry.lastCol;
+        entry.count = 0;
+        entry.row = entry.lastRow;
+        entry.col = entry.lastCol;
+    }
+    m_dirty.clear();
+    emit logged(list);
+}
+
+void FbLogBuffer::warning(int row, int col, const QString &msg)
+{
+    add(QtWarningMsg, row, col, msg);
+}
+
+void FbLogBuffer::error(int row, int col, const QString &msg)
+{
+    add(QtCriticalMsg, row, col, msg);
+    if (!m_failed) emit failed(row, col);
+    m_failed = true;
+}
+
+void FbLogBuffer::fatal(int row, int col, const QString &msg)
+{
+    add(QtFatalMsg, row, col, msg);
+    if (!m_failed) emit failed(row, col);
+    m_failed = true;
+}
+
 //---------------------------------------------------------------------------
 //  FbLogModel::FbLogItem
 //---------------------------------------------------------------------------
@@ -17,6 +104,13 @@ QVariant FbLogModel::FbLogItem::icon() const
     return QVariant();
 }
 
+void FbLogModel::FbLogItem::merge(const FbLogItem &item)
+{
+    m_count += item.m_count;
+    m_lastRow = item.m_lastRow;
+    m_lastCol = item.m_lastCol;
+}
+
 //---------------------------------------------------------------------------
 //  FbLogModel
 //---------------------------------------------------------------------------
@@ -24,7 +118,8 @@ QVariant FbLogModel::FbLogItem::icon() const
 FbLogModel::FbLogModel(QObject *parent)
     : QAbstractListModel(parent)
 {
-    foreach (FbLogItem *item, m_list) delete item;
+    QSettings settings;
+    m_list.setCapacity(qMax(1, settings.value("log/limit", 1000).toInt()));
 }
 
 QVariant FbLogModel::data(const QModelIndex &index, int role) const
@@ -32,9 +127,22 @@ QVariant FbLogModel::data(const QModelIndex &index, int role) const
     int row = index.row();
     if (row < 0) return QVariant();
     if (row >= m_list.count()) return QVariant();
+    const FbLogItem &item = m_list.at(m_list.firstIndex() + row);
     switch (role) {
-        case Qt::DisplayRole: return m_list.at(row)->msg();
-        case Qt::DecorationRole: return m_list.at(row)->icon();
+        case Qt::DisplayRole: {
+            if (item.count() < 2) return item.msg();
+            return tr("%1 (%2 times)").arg(item.msg(), QString::number(item.count()));
+        }
+        case Qt::ToolTipRole: {
+            if (!item.row()) return QVariant();
+            QString first = tr("Line %1, column %2").arg(item.row()).arg(item.col());
+            if (item.count() < 2) return first;
+            QString last = tr("Line %1, column %2").arg(item.lastRow()).arg(item.lastCol());
+            return tr("First: %1\nLast: %2").arg(first, last);
+        }
+        case Qt::DecorationRole: return item.icon();
+        case Qt::UserRole + 0: return item.row();
+        case Qt::UserRole + 1: return item.col();
     }
     return QVariant();
 }
@@ -45,14 +153,39 @@ int FbLogModel::rowCount(const QModelIndex &parent) const
     return m_list.count();
 }
 
-void FbLogModel::add(QtMsgType type, int row, int col, const QString &msg)
+int FbLogModel::merge(const FbLogItem &item)
 {
-    int count = m_list.count();
-    QModelIndex parent = QModelIndex();
-    beginInsertRows(parent, count, count);
-    m_list.append(new FbLogItem(type, row, col, msg));
+    // Repeated messages update their row, the oldest row is dropped
+    // once the log is full; returns the row that was touched.
+    QString id = FbLogBuffer::key(item.type(), item.msg());
+    int index = m_keys.value(id, -1);
+    if (index >= 0 && m_list.containsIndex(index)) {
+        m_list[index].merge(item);
+        int row = index - m_list.firstIndex();
+        emit dataChanged(createIndex(row, 0), createIndex(row, 0));
+        return row;
+    }
+
+    if (m_list.isFull()) {
+        const FbLogItem &first = m_list.first();
+        beginRemoveRows(QModelIndex(), 0, 0);
+        m_keys.remove(FbLogBuffer::key(first.type(), first.msg()));
+        m_list.removeFirst();
+        endRemoveRows();
+    }
+
+    int row = m_list.count();
+    beginInsertRows(QModelIndex(), row, row);
+    m_list.append(item);
+    m_keys.insert(id, m_list.lastIndex());
     endInsertRows();
-    emit changeCurrent(createIndex(count, 0));
+    return row;
+}
+
+void FbLogModel::add(QtMsgType type, int row, int col, const QString &msg)
+{
+    int index = merge(FbLogItem(type, row, col, msg));
+    emit changeCurrent(createIndex(index, 0));
 }
 
 void FbLogModel::add(QtMsgType type, const QString &msg)
@@ -60,6 +193,20 @@ void FbLogModel::add(QtMsgType type, const QString &msg)
     add(type, 0, 0, msg);
 }
 
+void FbLogModel::add(const QVariantList &list)
+{
+    // Batches of (type, message, count, row, col, last row, last col)
+    int index = -1;
+    for (int i = 0; i + 6 < list.count(); i += 7) {
+        QtMsgType type = QtMsgType(list.at(i).toInt());
+        FbLogItem item(type, list.at(i + 3).toInt(), list.at(i + 4).toInt(), list.at(i + 1).toString(), list.at(i + 2).toInt());
+        FbLogItem last(type, list.at(i + 5).toInt(), list.at(i + 6).toInt(), QString(), 0);
+        item.merge(last);
+        index = merge(item);
+    }
+    if (index >= 0) emit changeCurrent(createIndex(index, 0));
+}
+
 //---------------------------------------------------------------------------
 //  FbLogList
 //---------------------------------------------------------------------------
@@ -69,6 +216,7 @@ FbLogList::FbLogList(QWidget *parent)
 {
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     setViewMode(ListMode);
+    setUniformItemSizes(true);
 }
 
 //---------------------------------------------------------------------------
@@ -82,6 +230,7 @@ FbLogDock::FbLogDock(const QString &title, QWidget *parent, Qt::WindowFlags flag
 {
     m_list->setModel(m_model);
     connect(m_model, SIGNAL(changeCurrent(QModelIndex)), m_list, SLOT(setCurrentIndex(QModelIndex)));
+    connect(m_list, SIGNAL(activated(QModelIndex)), SLOT(activated(QModelIndex)));
     setFeatures(QDockWidget::AllDockWidgetFeatures);
     setAttribute(Qt::WA_DeleteOnClose);
     setWidget(m_list);
@@ -92,3 +241,19 @@ void FbLogDock::append(QtMsgType type, const QString &message)
     m_model->add(type, message);
 }
 
+void FbLogDock::append(QtMsgType type, int row, int col, const QString &message)
+{
+    m_model->add(type, row, col, message);
+}
+
+void FbLogDock::activated(const QModelIndex &index)
+{
+    int row = index.data(Qt::UserRole + 0).toInt();
+    int col = index.data(Qt::UserRole + 1).toInt();
+    if (row > 0) emit showLine(row, col);
+}
+
+void FbLogDock::append(const QVariantList &list)
+{
+    m_model->add(list);
+}
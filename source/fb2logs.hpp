@@ -2,8 +2,52 @@
 #define FB2LOGS_H
 
 #include <QAbstractListModel>
+#include <QContiguousCache>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QListView>
 #include <QDockWidget>
+#include <QVariant>
+
+class FbLogBuffer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FbLogBuffer(QObject *parent = 0);
+    static QString key(QtMsgType type, const QString &msg);
+    void add(QtMsgType type, int row, int col, const QString &msg);
+    void flush();
+
+signals:
+    void logged(const QVariantList &list);
+    void failed(int row, int col);
+
+public slots:
+    void warning(int row, int col, const QString &msg);
+    void error(int row, int col, const QString &msg);
+    void fatal(int row, int col, const QString &msg);
+
+private:
+    class Entry
+    {
+    public:
+        QtMsgType type;
+        QString msg;
+        int count;
+        int row;
+        int col;
+        int lastRow;
+        int lastCol;
+    };
+
+private:
+    QList<Entry> m_entries;
+    QHash<QString, int> m_keys;
+    QList<int> m_dirty;
+    QElapsedTimer m_timer;
+    bool m_failed;
+};
 
 class FbLogModel : public QAbstractListModel
 {
@@ -13,6 +57,7 @@ public:
     FbLogModel(QObject *parent = 0);
     void add(QtMsgType type, int row, int col, const QString &msg);
     void add(QtMsgType type, const QString &msg);
+    void add(const QVariantList &list);
 
 public:
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
@@ -25,28 +70,38 @@ private:
     class FbLogItem
     {
     public:
-        FbLogItem(QtMsgType type, int row, int col, const QString &msg)
-            : m_type(type), m_msg(msg), m_row(row), m_col(col) {}
+        FbLogItem()
+            : m_type(QtDebugMsg), m_count(0), m_row(0), m_col(0), m_lastRow(0), m_lastCol(0) {}
 
-        FbLogItem(QtMsgType type, const QString &msg)
-            : m_type(type), m_msg(msg), m_row(0), m_col(0) {}
+        FbLogItem(QtMsgType type, int row, int col, const QString &msg, int count = 1)
+            : m_type(type), m_msg(msg), m_count(count), m_row(row), m_col(col), m_lastRow(row), m_lastCol(col) {}
 
         const QString & msg() const { return m_msg; }
         QtMsgType type() const { return m_type; }
+        int count() const { return m_count; }
         int row() const { return m_row; }
-        int col() const { return m_row; }
+        int col() const { return m_col; }
+        int lastRow() const { return m_lastRow; }
+        int lastCol() const { return m_lastCol; }
+        void merge(const FbLogItem &item);
         QVariant icon() const;
 
     private:
         QtMsgType m_type;
         QString m_msg;
+        int m_count;
         int m_row;
         int m_col;
-
+        int m_lastRow;
+        int m_lastCol;
     };
 
 private:
-    QList<FbLogItem*> m_list;
+    int merge(const FbLogItem &item);
+
+private:
+    QContiguousCache<FbLogItem> m_list;
+    QHash<QString, int> m_keys;
 };
 
 class FbLogList: public QListView
@@ -70,6 +125,14 @@ class FbLogDock: public QDockWidget
 public:
     explicit FbLogDock(const QString &title, QWidget *parent = 0, Qt::WindowFlags flags = 0);
     void append(QtMsgType type, const QString &message);
+    void append(QtMsgType type, int row, int col, const QString &message);
+    void append(const QVariantList &list);
+
+signals:
+    void showLine(int row, int col);
+
+private slots:
+    void activated(const QModelIndex &index);
 
 private:
     FbLogModel *m_model;
@@ -5,6 +5,7 @@
 #include <QTreeView>
 #include <QWebFrame>
 #include <QMessageBox>
+#include <QSaveFile>
 #include <QMenuBar>
 #include <QStatusBar>
 
@@ -54,35 +55,43 @@ FbMainWindow::FbMainWindow(const QString &filename, ViewMode mode)
 
 void FbMainWindow::warning(int row, int col, const QString &msg)
 {
-    Q_UNUSED(row);
-    Q_UNUSED(col);
-    logMessage(QtWarningMsg, msg.simplified());
+    showLog();
+    logDock->append(QtWarningMsg, row, col, msg.simplified());
 }
 
 void FbMainWindow::error(int row, int col, const QString &msg)
 {
-    Q_UNUSED(row);
-    Q_UNUSED(col);
-    logMessage(QtCriticalMsg, msg.simplified());
+    showLog();
+    logDock->append(QtCriticalMsg, row, col, msg.simplified());
 }
 
 void FbMainWindow::fatal(int row, int col, const QString &msg)
 {
-    Q_UNUSED(row);
-    Q_UNUSED(col);
-    logMessage(QtFatalMsg, msg.simplified());
+    showLog();
+    logDock->append(QtFatalMsg, row, col, msg.simplified());
+}
+
+void FbMainWindow::logged(const QVariantList &list)
+{
+    showLog();
+    logDock->append(list);
 }
 
 void FbMainWindow::logMessage(QtMsgType type, const QString &message)
 {
-    if (!logDock) {
-        logDock = new FbLogDock(tr("Message log"), this);
-        connect(logDock, SIGNAL(destroyed()), SLOT(logDestroyed()));
-        addDockWidget(Qt::BottomDockWidgetArea, logDock);
-    }
+    showLog();
     logDock->append(type, message);
 }
 
+void FbMainWindow::showLog()
+{
+    if (logDock) return;
+    logDock = new FbLogDock(tr("Message log"), this);
+    connect(logDock, SIGNAL(destroyed()), SLOT(logDestroyed()));
+    connect(logDock, SIGNAL(showLine(int,int)), mainDock, SLOT(showLine(int,int)));
+    addDockWidget(Qt::BottomDockWidgetArea, logDock);
+}
+
 void FbMainWindow::logDestroyed()
 {
     logDock = NULL;
@@ -299,6 +308,11 @@ void FbMainWindow::createActions()
     code->setAction(Fb::CheckText, act);
     menu->addAction(act);
 
+    act = new QAction(tr("&Optimize images..."), this);
+    act->setStatusTip(tr("Recompress and downscale embedded pictures"));
+    text->setAction(Fb::OptimizeImages, act);
+    menu->addAction(act);
+
     menu->addSeparator();
 
     act = new QAction(FbIcon("preferences-desktop"), tr("&Settings"), this);
@@ -501,6 +515,11 @@ void FbMainWindow::createActions()
     act->setCheckable(true);
     menu->addAction(act);
 
+    act = new QAction(tr("&Statistics"), this);
+    text->setAction(Fb::ViewStatistics, act);
+    act->setCheckable(true);
+    menu->addAction(act);
+
     act = new QAction(tr("&Web inspector"), this);
     text->setAction(Fb::ViewInspector, act);
     act->setCheckable(true);
@@ -571,14 +590,30 @@ bool FbMainWindow::maybeSave()
 
 bool FbMainWindow::saveFile(const QString &fileName, const QString &codec)
 {
-    QFile file(fileName);
+    // The mapped file of a large document is replaced as a whole
+    if (mainDock->code()->isLarge()) {
+        bool ok = mainDock->code()->save(fileName);
+        if (ok) setCurrentFile(fileName);
+        return ok;
+    }
+
+    // The file is replaced only once the whole book was written
+    QSaveFile file(fileName);
     if (!file.open(QFile::WriteOnly | QFile::Text)) {
         QMessageBox::warning(this, qApp->applicationName(), tr("Cannot write file %1: %2.").arg(fileName).arg(file.errorString()));
         return false;
     }
-    bool ok = mainDock->save(&file, codec);
+    if (!mainDock->save(&file, codec)) {
+        file.cancelWriting();
+        QMessageBox::warning(this, qApp->applicationName(), tr("Cannot write file %1: a binary placeholder has no data.").arg(fileName));
+        return false;
+    }
+    if (!file.commit()) {
+        QMessageBox::warning(this, qApp->applicationName(), tr("Cannot write file %1: %2.").arg(fileName).arg(file.errorString()));
+        return false;
+    }
     setCurrentFile(fileName);
-    return ok;
+    return true;
 }
 
 void FbMainWindow::setCurrentFile(const QString &filename)
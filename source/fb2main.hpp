@@ -40,6 +40,7 @@ public slots:
     void warning(int row, int col, const QString &msg);
     void error(int row, int col, const QString &msg);
     void fatal(int row, int col, const QString &msg);
+    void logged(const QVariantList &list);
     void logMessage(QtMsgType type, const QString &message);
     void status(const QString &text);
 
@@ -64,6 +65,7 @@ private:
     void createImgs();
     void createActions();
     void createStatusBar();
+    void showLog();
     void readSettings();
     void writeSettings();
     bool maybeSave();
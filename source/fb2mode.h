@@ -26,6 +26,7 @@ enum Actions {
     EditFind,
     EditReplace,
     CheckText,
+    OptimizeImages,
     InsertImage,
     InsertNote,
     InsertLink,
@@ -55,6 +56,7 @@ enum Actions {
     ViewContents,
     ViewPictures,
     ViewFootnotes,
+    ViewStatistics,
     ViewInspector,
     ZoomIn,
     ZoomOut,
@@ -183,6 +183,7 @@ FbNotesWidget::FbNotesWidget(FbTextEdit *text, QWidget* parent)
     layout->addWidget(splitter);
 
     connect(m_text, SIGNAL(loadFinished(bool)), SLOT(loadFinished()));
+    connect(m_text->page(), SIGNAL(contentsChanged()), SLOT(contentsChanged()));
     connect(m_list, SIGNAL(showCurrent(QString)), SLOT(showCurrent(QString)));
     connect(m_list, SIGNAL(activated(QModelIndex)), SLOT(activated(QModelIndex)));
     loadFinished();
@@ -199,13 +200,22 @@ void FbNotesWidget::loadFinished()
 {
     if (QAbstractItemModel *m = m_list->model()) m->deleteLater();
     m_view->load(QUrl());
+    m_current.clear();
     m_list->setModel(new FbNotesModel(m_text->page(), this));
     m_list->reset();
     m_list->setColumnHidden(0, true);
 }
 
+void FbNotesWidget::contentsChanged()
+{
+    // The note on display may have been edited, show it anew
+    m_current.clear();
+}
+
 void FbNotesWidget::showCurrent(const QString &name)
 {
+    if (name == m_current) return;
+    m_current = name;
     QWebElement element = m_text->body().findFirst(name);
     QString html = element.toInnerXml();
     html.prepend(
@@ -213,5 +223,6 @@ void FbNotesWidget::showCurrent(const QString &name)
         "<fb:section id=0 style='border:0;padding:0;margin:0;'>"
     );
     html.append("</fb:section></fb:body>");
+    html.replace(" data-src=", " src=");
     m_view->setHtml(html, m_view->url());
 }
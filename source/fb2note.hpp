@@ -69,11 +69,13 @@ private slots:
     void activated(const QModelIndex &index);
     void showCurrent(const QString &name);
     void loadFinished();
+    void contentsChanged();
 
 private:
     FbTextEdit *m_text;
     QTreeView *m_list;
     QWebView *m_view;
+    QString m_current;
 };
 
 #endif // FB2NOTE_H
@@ -1,13 +1,17 @@
 #include "fb2page.hpp"
 
+#include <QSet>
+#include <QSettings>
 #include <QTimer>
 #include <QWebFrame>
 #include <QtDebug>
 
 #include "fb2read.hpp"
 #include "fb2save.hpp"
+#include "fb2stat.hpp"
 #include "fb2imgs.hpp"
 #include "fb2utils.h"
+#include "fb2valid.hpp"
 #include "fb2html.h"
 #include "fb2xml2.h"
 
@@ -20,6 +24,33 @@ void FbTextLogger::trace(const QString &text)
     qCritical() << text;
 }
 
+//---------------------------------------------------------------------------
+//  FbTextFragments
+//---------------------------------------------------------------------------
+
+FbTextFragments::FbTextFragments(FbTextPage *parent)
+    : QObject(parent)
+    , m_page(parent)
+{
+}
+
+QString FbTextFragments::html(int index)
+{
+    FbStore *store = m_page->manager()->store();
+    return store ? store->fragment(index) : QString();
+}
+
+int FbTextFragments::newNode()
+{
+    FbStore *store = m_page->manager()->store();
+    return store ? store->newNode() : 0;
+}
+
+void FbTextFragments::changed(const QString &location)
+{
+    m_page->notify(m_page->element(location), false);
+}
+
 //---------------------------------------------------------------------------
 //  FbTextPage
 //---------------------------------------------------------------------------
@@ -27,6 +58,16 @@ void FbTextLogger::trace(const QString &text)
 FbTextPage::FbTextPage(QObject *parent)
     : QWebPage(parent)
     , m_logger(this)
+    , m_fragments(this)
+    , m_root(0)
+    , m_check(0)
+    , m_serial(0)
+    , m_counted(0)
+    , m_floor(0)
+    , m_history(0)
+    , m_limit(0)
+    , m_observer(false)
+    , m_reset(true)
 {
     QWebSettings *s = settings();
     s->setAttribute(QWebSettings::AutoLoadImages, true);
@@ -37,6 +78,7 @@ FbTextPage::FbTextPage(QObject *parent)
     s->setAttribute(QWebSettings::PluginsEnabled, false);
     s->setAttribute(QWebSettings::ZoomTextOnly, true);
     s->setUserStyleSheetUrl(getStyleSheetUrl());
+    QWebSettings::setObjectCacheCapacities(0, 8 << 20, 32 << 20);
 
     QString html = block("body", block("section", p()));
     mainFrame()->setHtml(html, createUrl());
@@ -45,7 +87,31 @@ FbTextPage::FbTextPage(QObject *parent)
     setNetworkAccessManager(new FbNetworkAccessManager(this));
     connect(this, SIGNAL(loadFinished(bool)), SLOT(loadFinished()));
     connect(this, SIGNAL(contentsChanged()), SLOT(fixContents()));
-    connect(this, SIGNAL(selectionChanged()), SLOT(showStatus()));
+    connect(this, SIGNAL(contentsChanged()), SLOT(resetStatus()));
+
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(100);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(showStatus()));
+    connect(this, SIGNAL(selectionChanged()), &m_timer, SLOT(start()));
+
+    m_indexer.setSingleShot(true);
+    m_indexer.setInterval(1000);
+    connect(&m_indexer, SIGNAL(timeout()), SLOT(updateIndex()));
+    connect(this, SIGNAL(contentsChanged()), SLOT(changeIndex()));
+
+    m_checker.setSingleShot(true);
+    m_checker.setInterval(500);
+    connect(&m_checker, SIGNAL(timeout()), SLOT(checkSection()));
+
+    QSettings settings;
+    m_limit = qint64(settings.value("undo/limit", 64).toInt()) << 20;
+    connect(undoStack(), SIGNAL(indexChanged(int)), SLOT(trimHistory()));
+}
+
+FbTextPage::~FbTextPage()
+{
+    // Commands unregister themselves while the page is still complete
+    undoStack()->clear();
 }
 
 QUrl FbTextPage::getStyleSheetUrl()
@@ -85,8 +151,15 @@ void FbTextPage::html(const QString &html, FbStore *store)
     QWebSettings::clearMemoryCaches();
     QUrl url = FbTextPage::createUrl();
     manager()->setStore(url, store);
+    m_observer = false;
+    m_indexer.stop();
+    m_root = 0;
+    m_checker.stop();
+    m_check = 0;
+    m_invalid.clear();
+    m_uncounted.clear();
+    m_counted++;
     mainFrame()->setHtml(html, url);
-
 }
 
 bool FbTextPage::acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest &request, NavigationType type)
@@ -99,6 +172,22 @@ bool FbTextPage::acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest
     return QWebPage::acceptNavigationRequest(frame, request, type);
 }
 
+void FbTextPage::triggerAction(WebAction action, bool checked)
+{
+    if (action == Undo && !canUndo()) return;
+    QWebPage::triggerAction(action, checked);
+    if (m_observer) return;
+    switch (action) {
+        case Paste:
+        case PasteAndMatchStyle:
+        case Undo:
+        case Redo:
+            fixDocument();
+            break;
+        default: ;
+    }
+}
+
 QUrl FbTextPage::createUrl()
 {
     static int number = 0;
@@ -306,8 +395,7 @@ void FbTextPage::insertText()
 void FbTextPage::createBlock(const QString &name)
 {
     QString style = name;
-    QString js1 = jScript("section_get.js");
-    QString result = mainFrame()->evaluateJavaScript(js1).toString();
+    QString result = mainFrame()->evaluateJavaScript("FbSectionGet()").toString();
     QStringList list = result.split("|");
     if (list.count() < 2) return;
     const QString location = list[0];
@@ -317,8 +405,8 @@ void FbTextPage::createBlock(const QString &name)
     FbTextElement duplicate = original.clone();
     original.appendOutside(duplicate);
     original.takeFromDocument();
-    QString js2 = jScript("section_new.js") + ";f(this,'fb:%1',%2)";
-    duplicate.evaluateJavaScript(js2.arg(style).arg(position));
+    QString javascript = "FbSectionNew(this,'fb:%1',%2)";
+    duplicate.evaluateJavaScript(javascript.arg(style).arg(position));
     QUndoCommand * command = new FbReplaceCmd(original, duplicate);
     push(command, tr("Create <%1>").arg(style));
 }
@@ -392,26 +480,292 @@ QString FbTextPage::location()
     return mainFrame()->evaluateJavaScript(javascript).toString();
 }
 
+void FbTextPage::resetStatus()
+{
+    m_reset = true;
+}
+
+int FbTextPage::nodeId()
+{
+    QString javascript = "FbNodeId(document.getSelection().anchorNode)";
+    return mainFrame()->evaluateJavaScript(javascript).toInt();
+}
+
 void FbTextPage::showStatus()
 {
-    QString javascript = jScript("get_status.js");
+    QString javascript = QString("FbStatus(%1)").arg(m_reset ? "true" : "false");
     QString text = mainFrame()->evaluateJavaScript(javascript).toString();
-    text.replace("FB:", "");
+    m_reset = false;
+    if (text == m_status) return;
+    m_status = text;
     emit status(text);
 }
 
 void FbTextPage::loadFinished()
 {
     mainFrame()->addToJavaScriptWindowObject("logger", &m_logger);
+    mainFrame()->addToJavaScriptWindowObject("fragments", &m_fragments);
+    foreach (QString filename, jScriptList()) {
+        mainFrame()->evaluateJavaScript(jScript(filename));
+    }
+    m_reset = true;
+    QVariant result = mainFrame()->evaluateJavaScript("FbFix.start()");
+    m_observer = result.toBool();
+    mainFrame()->evaluateJavaScript("FbVirtual.start()");
     body().select();
 }
 
+void FbTextPage::notify(const QWebElement &parent, bool edited)
+{
+    // Folding a section changes its markup only, the index
+    // keeps track of fragments and needs no update for it.
+    emit structureChanged(parent);
+    if (!edited) return;
+    QWebElement element = parent;
+    changeIndex(element.evaluateJavaScript("FbIndexRoot(this)").toInt());
+}
+
+void FbTextPage::changeIndex()
+{
+    QString javascript = "FbIndexRoot(document.getSelection().anchorNode)";
+    changeIndex(mainFrame()->evaluateJavaScript(javascript).toInt());
+}
+
+void FbTextPage::changeIndex(int root)
+{
+    // Edits are collected per top-level section, a change anywhere
+    // else or in several sections at once reindexes the document.
+    if (root <= 0) emit descriptionChanged();
+    if (root == 0) return;
+    if (root > 0) {
+        m_check = root;
+        m_checker.start();
+    }
+    if (m_root && m_root != root) root = -1;
+    m_root = root;
+    m_indexer.start();
+}
+
+void FbTextPage::checkSection()
+{
+    // The content model of the last edited top-level section is
+    // checked on a worker thread, the page keeps only the markers.
+    int root = m_check;
+    m_check = 0;
+    if (root <= 0) return;
+    QString javascript = QString("FbOutline(%1)").arg(root);
+    QVariantList outline = mainFrame()->evaluateJavaScript(javascript).toList();
+    if (outline.isEmpty()) return;
+    FbTextChecker::execute(this, ++m_serial, root, outline);
+}
+
+void FbTextPage::checked(int serial, int root, const QVariantList &errors)
+{
+    if (serial != m_serial) return;
+
+    QHash<int, QString> found;
+    QStringList list;
+    for (int i = 0; i + 1 < errors.count(); i += 2) {
+        int id = errors.at(i).toInt();
+        QString msg = errors.at(i + 1).toString();
+        list << QString::number(id) << jString(msg);
+        found.insert(id, msg);
+    }
+
+    QHash<int, QString> &known = m_invalid[root];
+    QHash<int, QString>::const_iterator it;
+    for (it = found.constBegin(); it != found.constEnd(); ++it) {
+        // The code view may lag behind the text, the message has no line
+        if (known.value(it.key()) != it.value()) qWarning("%s", qPrintable(it.value()));
+    }
+    if (found.isEmpty() && known.isEmpty()) return;
+    known = found;
+
+    QString javascript = QString("FbMarkInvalid(%1,[%2])").arg(QString::number(root), list.join(","));
+    mainFrame()->evaluateJavaScript(javascript);
+}
+
+void FbTextPage::updateIndex()
+{
+    FbStore *store = manager()->store();
+    int root = m_root;
+    m_root = 0;
+    if (!store || !root) return;
+
+    FbTextIndex &index = store->index();
+    if (root > 0) {
+        QWebElement element = doc().findFirst(QString("[data-node='%1']").arg(root));
+        if (!element.isNull()) {
+            QVariantList list = element.evaluateJavaScript("FbIndex(this)").toList();
+            m_uncounted.insert(root);
+            root = index.replace(root, list, *store) ? 0 : -1;
+        }
+    }
+    if (root) {
+        QVariantList list = mainFrame()->evaluateJavaScript("FbIndex(document.body)").toList();
+        index.build(list, *store);
+        m_uncounted.insert(-1);
+    }
+    countIndex();
+    emit indexChanged();
+}
+
+void FbTextPage::countIndex()
+{
+    // Statistics of the reindexed sections are recounted on a worker
+    // thread, changes made meanwhile wait for the running one.
+    FbStore *store = manager()->store();
+    if (!store || m_uncounted.isEmpty() || !m_counting.isEmpty()) return;
+    m_counting = m_uncounted;
+    m_uncounted.clear();
+    FbTextCounter::execute(this, ++m_counted, store->index(), m_counting);
+}
+
+void FbTextPage::counted(int serial, const QVariantList &counts)
+{
+    FbStore *store = manager()->store();
+    if (store && serial == m_counted) {
+        store->stats().merge(m_counting, counts);
+        emit statsChanged();
+    }
+    m_counting.clear();
+    countIndex();
+}
+
+void FbTextPage::flushIndex()
+{
+    if (!m_indexer.isActive()) return;
+    m_indexer.stop();
+    updateIndex();
+}
+
+void FbTextPage::resetIndex()
+{
+    changeIndex(-1);
+}
+
+int FbTextPage::replaceText(const FbTextIndex &index, const QList<FbTextIndex::Match> &matches)
+{
+    QSet<int> fragments;
+    QStringList list;
+    foreach (const FbTextIndex::Match &match, matches) {
+        const FbTextIndex::Entry &entry = index.at(match.entry);
+        if (entry.fragment >= 0) fragments << entry.fragment;
+        list << QString::number(entry.node);
+        list << QString::number(entry.number);
+        list << QString::number(match.pos);
+        list << QString::number(match.len);
+        list << jString(match.text);
+    }
+
+    foreach (int fragment, fragments) {
+        mainFrame()->evaluateJavaScript(QString("FbVirtual.expand(%1)").arg(fragment));
+    }
+
+    // All matches are applied in one pass, the command keeps the old
+    // and new markup of every changed paragraph.
+    QString javascript = QString("FbReplaceText([%1])").arg(list.join(","));
+    QVariantList result = mainFrame()->evaluateJavaScript(javascript).toList();
+    int count = result.count() / 4;
+    if (!count) return 0;
+
+    QStringList changes;
+    for (int i = 0; i < count * 4; i += 4) {
+        changes << QString::number(result[i].toInt());
+        changes << QString::number(result[i + 1].toInt());
+        changes << jString(result[i + 2].toString());
+        changes << jString(result[i + 3].toString());
+    }
+    QUndoCommand *command = new FbReplaceTextCmd(body(), QString("[%1]").arg(changes.join(",")));
+    push(command, tr("Replace all"));
+    resetIndex();
+    return count;
+}
+
+bool FbTextPage::selectText(int fragment, int node, int number, int pos, int len)
+{
+    if (fragment >= 0) {
+        mainFrame()->evaluateJavaScript(QString("FbVirtual.expand(%1)").arg(fragment));
+    }
+    QString javascript = QString("FbSelectText(%1,%2,%3,%4)").arg(node).arg(number).arg(pos).arg(len);
+    return mainFrame()->evaluateJavaScript(javascript).toBool();
+}
+
+void FbTextPage::expandFragments(const QString &text, Qt::CaseSensitivity cs)
+{
+    FbStore *store = manager()->store();
+    if (!store) return;
+
+    // Fragments keep the escaped markup written by the reader
+    QString escaped = text;
+    escaped.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;");
+
+    const QStringList &list = store->fragments();
+    for (int i = 0; i < list.count(); i++) {
+        if (escaped.isEmpty() || list[i].contains(escaped, cs)) {
+            mainFrame()->evaluateJavaScript(QString("FbVirtual.expand(%1)").arg(i));
+        }
+    }
+}
+
 void FbTextPage::fixContents()
 {
+    // Inserted and restyled nodes are cleaned by the page observer,
+    // without it only the block under the caret is sanitized.
+    if (m_observer) return;
+    QVariant result = mainFrame()->evaluateJavaScript("FbFix.caret()");
+    if (!result.toBool()) fixDocument();
+}
+
+void FbTextPage::fixDocument()
+{
+    QVariant result = mainFrame()->evaluateJavaScript("FbFix.all(),true");
+    if (result.toBool()) return;
     foreach (QWebElement span, doc().findAll("span.apple-style-span[style]")) {
         span.removeAttribute("style");
     }
-    foreach (QWebElement span, doc().findAll("[style]")) {
+    foreach (QWebElement span, doc().findAll("[style]:not([data-fragment])")) {
         span.removeAttribute("style");
     }
 }
+
+void FbTextPage::detach(FbTextCommand *command)
+{
+    m_history -= command->memory();
+}
+
+static void expireCommand(const QUndoCommand *command)
+{
+    // The stack hands out its commands as constant ones only
+    if (const FbTextCommand *text = dynamic_cast<const FbTextCommand*>(command)) {
+        const_cast<FbTextCommand*>(text)->expire();
+    }
+    int count = command->childCount();
+    for (int i = 0; i < count; i++) expireCommand(command->child(i));
+}
+
+void FbTextPage::account(int memory)
+{
+    m_history += memory;
+}
+
+void FbTextPage::trimHistory()
+{
+    // Whole entries of the stack are expired from the oldest one,
+    // native editing steps included, and undo stops at the first
+    // entry left. The latest one is kept even if it alone does not
+    // fit into the limit.
+    QUndoStack *stack = undoStack();
+    m_floor = qMin(m_floor, stack->count());
+    if (m_history > m_limit && m_floor < stack->index() - 1) {
+        qint64 before = m_history;
+        int count = 0;
+        while (m_history > m_limit && m_floor < stack->index() - 1) {
+            expireCommand(stack->command(m_floor++));
+            count++;
+        }
+        m_status = tr("Undo history trimmed: %1 steps expired, %2 KB released").arg(count).arg((before - m_history) >> 10);
+        emit status(m_status);
+    }
+    emit historyChanged();
+}
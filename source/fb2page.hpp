@@ -2,15 +2,22 @@
 #define FB2PAGE_HPP
 
 #include <QAction>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
 #include <QUndoCommand>
 #include <QWebPage>
 
 class FbStore;
+class FbTextCommand;
 class FbTextElement;
 class FbNetworkAccessManager;
 
 #include "fb2logs.hpp"
 #include "fb2mode.h"
+#include "fb2srch.hpp"
+
+class FbTextPage;
 
 class FbTextLogger : public QObject
 {
@@ -24,12 +31,29 @@ public slots:
 
 };
 
+class FbTextFragments : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FbTextFragments(FbTextPage *parent);
+
+public slots:
+    QString html(int index);
+    void changed(const QString &location);
+    int newNode();
+
+private:
+    FbTextPage *m_page;
+};
+
 class FbTextPage : public QWebPage
 {
     Q_OBJECT
 
 public:
     explicit FbTextPage(QObject *parent = 0);
+    virtual ~FbTextPage();
     FbNetworkAccessManager *manager();
     bool read(const QString &html);
     bool read(QIODevice *device);
@@ -37,6 +61,7 @@ public:
     FbTextElement element(const QString &location);
     FbTextElement current();
     QString location();
+    int nodeId();
 
     FbTextElement body();
     FbTextElement doc();
@@ -44,6 +69,17 @@ public:
     FbTextElement appendSection(const FbTextElement &parent);
     FbTextElement appendTitle(const FbTextElement &parent);
     FbTextElement appendText(const FbTextElement &parent);
+    void expandFragments(const QString &text = QString(), Qt::CaseSensitivity cs = Qt::CaseInsensitive);
+    void notify(const QWebElement &parent, bool edited = true);
+    bool selectText(int fragment, int node, int number, int pos, int len);
+    int replaceText(const FbTextIndex &index, const QList<FbTextIndex::Match> &matches);
+    void flushIndex();
+    void resetIndex();
+    void detach(FbTextCommand *command);
+    void account(int memory);
+    bool canUndo() const { return undoStack()->index() > m_floor; }
+    qint64 historyMemory() const { return m_history; }
+    qint64 historyLimit() const { return m_limit; }
     static QUrl createUrl();
 
 signals:
@@ -51,6 +87,13 @@ signals:
     void warning(int row, int col, const QString &msg);
     void error(int row, int col, const QString &msg);
     void fatal(int row, int col, const QString &msg);
+    void logged(const QVariantList &list);
+    void parseFailed(int row, int col);
+    void structureChanged(const QWebElement &parent);
+    void descriptionChanged();
+    void indexChanged();
+    void statsChanged();
+    void historyChanged();
 
 public slots:
     void html(const QString &html, FbStore *store);
@@ -71,6 +114,7 @@ public slots:
 
 protected:
     virtual bool acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest &request, NavigationType type);
+    virtual void triggerAction(WebAction action, bool checked = false);
     void createBlock(const QString &name);
 
 protected:
@@ -82,15 +126,42 @@ protected:
 private slots:
     void loadFinished();
     void fixContents();
+    void resetStatus();
     void showStatus();
+    void changeIndex();
+    void updateIndex();
+    void trimHistory();
+    void checkSection();
+    void checked(int serial, int root, const QVariantList &errors);
+    void counted(int serial, const QVariantList &counts);
 
 private:
     QUrl getStyleSheetUrl();
+    void fixDocument();
+    void changeIndex(int root);
+    void countIndex();
 
 private:
     FbActionMap m_actions;
     FbTextLogger m_logger;
+    FbTextFragments m_fragments;
     QString m_html;
+    QTimer m_timer;
+    QString m_status;
+    QTimer m_indexer;
+    int m_root;
+    QTimer m_checker;
+    int m_check;
+    int m_serial;
+    QHash<int, QHash<int, QString> > m_invalid;
+    QSet<int> m_uncounted;
+    QSet<int> m_counting;
+    int m_counted;
+    int m_floor;
+    qint64 m_history;
+    qint64 m_limit;
+    bool m_observer;
+    bool m_reset;
 };
 
 #endif // FB2PAGE_HPP
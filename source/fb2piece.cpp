@@ -0,0 +1,293 @@
+#include "fb2piece.hpp"
+
+#include <QObject>
+#include <QSaveFile>
+#include <QTextCodec>
+
+#include <algorithm>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+//  FbPieceTable
+//---------------------------------------------------------------------------
+
+FbPieceTable::FbPieceTable()
+    : m_mapped(0)
+    , m_codec(0)
+    , m_size(0)
+    , m_lines(0)
+    , m_modified(false)
+{
+}
+
+FbPieceTable::~FbPieceTable()
+{
+    if (m_mapped && m_file.size()) m_file.unmap((uchar*) m_mapped);
+}
+
+bool FbPieceTable::map(const QString &filename)
+{
+    m_mapped = 0;
+    m_file.close();
+    m_file.setFileName(filename);
+    if (!m_file.open(QFile::ReadOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+    if (m_file.size() == 0) {
+        m_mapped = "";
+        return true;
+    }
+    m_mapped = (const char*) m_file.map(0, m_file.size());
+    if (!m_mapped) {
+        m_error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool FbPieceTable::open(const QString &filename)
+{
+    // The file stays mapped, edits go to an append-only buffer
+    // and the document is the sequence of pieces of both.
+    if (m_mapped && m_file.size()) m_file.unmap((uchar*) m_mapped);
+    if (!map(filename)) return false;
+
+    m_size = m_file.size();
+    m_added.clear();
+    m_breaks.clear();
+    m_pieces.clear();
+    m_modified = false;
+
+    const char *begin = m_mapped;
+    const char *end = m_mapped + m_size;
+    while (begin < end) {
+        const char *next = (const char*) memchr(begin, '\n', end - begin);
+        if (!next) break;
+        m_breaks.append(next - m_mapped);
+        begin = next + 1;
+    }
+    m_lines = m_breaks.count();
+
+    if (m_size) {
+        Piece piece;
+        piece.added = false;
+        piece.start = 0;
+        piece.length = m_size;
+        piece.lines = m_lines;
+        m_pieces.append(piece);
+    }
+
+    QString head = QString::fromLatin1(m_mapped, qMin(m_size, qint64(1024)));
+    QRegularExpression expr("encoding\\s*=\\s*[\"']([^\"']+)[\"']");
+    QRegularExpressionMatch match = expr.match(head);
+    m_codec = match.hasMatch() ? QTextCodec::codecForName(match.captured(1).toLatin1()) : 0;
+    if (!m_codec) m_codec = QTextCodec::codecForName("UTF-8");
+    if (m_codec->fromUnicode(QString("<\n>")) != "<\n>") {
+        m_error = QObject::tr("Encoding %1 is not supported").arg(QString(m_codec->name()));
+        return false;
+    }
+    return true;
+}
+
+bool FbPieceTable::save(const QString &filename)
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    foreach (const Piece &piece, m_pieces) {
+        if (file.write(data(piece), piece.length) != piece.length) break;
+    }
+
+    // The mapped file may be the one replaced, so it is released
+    // before the commit and the table is rebuilt from the result.
+    QString source = m_file.fileName();
+    if (m_mapped && m_file.size()) m_file.unmap((uchar*) m_mapped);
+    m_mapped = 0;
+    m_file.close();
+    if (!file.commit()) {
+        m_error = file.errorString();
+        map(source);
+        return false;
+    }
+    return open(filename);
+}
+
+const char * FbPieceTable::data(const Piece &piece) const
+{
+    return (piece.added ? m_added.constData() : m_mapped) + piece.start;
+}
+
+int FbPieceTable::count(const Piece &piece, qint64 length) const
+{
+    if (piece.added) {
+        const char *begin = data(piece);
+        return std::count(begin, begin + length, '\n');
+    }
+    QVector<qint64>::const_iterator first = std::lower_bound(m_breaks.begin(), m_breaks.end(), piece.start);
+    QVector<qint64>::const_iterator last = std::lower_bound(first, m_breaks.end(), piece.start + length);
+    return last - first;
+}
+
+qint64 FbPieceTable::nth(const Piece &piece, int n) const
+{
+    // Offset within the piece right after its n-th line break
+    if (piece.added) {
+        const char *begin = data(piece);
+        for (qint64 i = 0; i < piece.length; i++) {
+            if (begin[i] == '\n' && --n == 0) return i + 1;
+        }
+        return piece.length;
+    }
+    QVector<qint64>::const_iterator first = std::lower_bound(m_breaks.begin(), m_breaks.end(), piece.start);
+    return *(first + n - 1) - piece.start + 1;
+}
+
+qint64 FbPieceTable::lineStart(int line) const
+{
+    if (line <= 0) return 0;
+    qint64 pos = 0;
+    foreach (const Piece &piece, m_pieces) {
+        if (piece.lines >= line) return pos + nth(piece, line);
+        line -= piece.lines;
+        pos += piece.length;
+    }
+    return m_size;
+}
+
+int FbPieceTable::lineOf(qint64 pos) const
+{
+    int line = 0;
+    qint64 start = 0;
+    foreach (const Piece &piece, m_pieces) {
+        if (pos < start + piece.length) return line + count(piece, pos - start);
+        line += piece.lines;
+        start += piece.length;
+    }
+    return line;
+}
+
+QByteArray FbPieceTable::read(qint64 pos, qint64 len) const
+{
+    QByteArray result;
+    qint64 start = 0;
+    foreach (const Piece &piece, m_pieces) {
+        qint64 end = start + piece.length;
+        if (end > pos && start < pos + len) {
+            qint64 from = qMax(pos, start);
+            qint64 to = qMin(pos + len, end);
+            result.append(data(piece) + from - start, to - from);
+        }
+        if (end >= pos + len) break;
+        start = end;
+    }
+    return result;
+}
+
+int FbPieceTable::split(qint64 pos)
+{
+    // Index of the piece starting at the position, splitting one if needed
+    qint64 start = 0;
+    for (int i = 0; i < m_pieces.count(); i++) {
+        if (pos == start) return i;
+        Piece &piece = m_pieces[i];
+        if (pos < start + piece.length) {
+            Piece tail = piece;
+            piece.length = pos - start;
+            piece.lines = count(piece, piece.length);
+            tail.start += piece.length;
+            tail.length -= piece.length;
+            tail.lines -= piece.lines;
+            m_pieces.insert(i + 1, tail);
+            return i + 1;
+        }
+        start += piece.length;
+    }
+    return m_pieces.count();
+}
+
+void FbPieceTable::replace(qint64 pos, qint64 len, const QByteArray &data)
+{
+    int first = split(pos);
+    int last = split(pos + len);
+    for (int i = first; i < last; i++) {
+        m_lines -= m_pieces.at(first).lines;
+        m_pieces.removeAt(first);
+    }
+    if (!data.isEmpty()) {
+        Piece piece;
+        piece.added = true;
+        piece.start = m_added.size();
+        piece.length = data.size();
+        m_added.append(data);
+        piece.lines = count(piece, piece.length);
+        m_lines += piece.lines;
+        m_pieces.insert(first, piece);
+    }
+    m_size += data.size() - len;
+    m_modified = true;
+}
+
+qint64 FbPieceTable::find(const QRegularExpression &expr, qint64 from, bool backward, qint64 &length) const
+{
+    // The text is decoded in chunks cut at line breaks, a match
+    // never spans lines as the search text is a single line.
+    const qint64 chunk = 1 << 20;
+    if (!backward) {
+        qint64 pos = from;
+        while (pos < m_size) {
+            QByteArray bytes = read(pos, qMin(chunk, m_size - pos));
+            if (pos + bytes.size() < m_size) {
+                int cut = bytes.lastIndexOf('\n');
+                if (cut >= 0) bytes.truncate(cut + 1);
+            }
+            if (bytes.isEmpty()) break;
+            QString text = decode(bytes);
+            QRegularExpressionMatch match = expr.match(text);
+            if (match.hasMatch()) {
+                length = encode(match.captured()).size();
+                return pos + encode(text.left(match.capturedStart())).size();
+            }
+            pos += bytes.size();
+        }
+    } else {
+        qint64 end = from;
+        while (end > 0) {
+            qint64 start = qMax(qint64(0), end - chunk);
+            QByteArray bytes = read(start, end - start);
+            if (start > 0) {
+                int cut = bytes.indexOf('\n');
+                if (cut >= 0 && cut + 1 < bytes.size()) {
+                    bytes = bytes.mid(cut + 1);
+                    start += cut + 1;
+                }
+            }
+            QString text = decode(bytes);
+            QRegularExpressionMatch last;
+            QRegularExpressionMatchIterator it = expr.globalMatch(text);
+            while (it.hasNext()) last = it.next();
+            if (last.hasMatch()) {
+                length = encode(last.captured()).size();
+                return start + encode(text.left(last.capturedStart())).size();
+            }
+            end = start;
+        }
+    }
+    return -1;
+}
+
+QString FbPieceTable::decode(const QByteArray &data) const
+{
+    // A byte order mark is kept as a character to be written back
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    return m_codec->toUnicode(data.constData(), data.size(), &state);
+}
+
+QByteArray FbPieceTable::encode(const QString &text) const
+{
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    return m_codec->fromUnicode(text.constData(), text.length(), &state);
+}
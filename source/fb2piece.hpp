@@ -0,0 +1,63 @@
+#ifndef FB2PIECE_H
+#define FB2PIECE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QRegularExpression>
+#include <QString>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QTextCodec;
+QT_END_NAMESPACE
+
+class FbPieceTable
+{
+public:
+    FbPieceTable();
+    ~FbPieceTable();
+    bool open(const QString &filename);
+    bool save(const QString &filename);
+    QString errorString() const { return m_error; }
+    bool isModified() const { return m_modified; }
+    qint64 size() const { return m_size; }
+    int lineCount() const { return m_lines + 1; }
+    qint64 lineStart(int line) const;
+    int lineOf(qint64 pos) const;
+    QByteArray read(qint64 pos, qint64 len) const;
+    void replace(qint64 pos, qint64 len, const QByteArray &data);
+    qint64 find(const QRegularExpression &expr, qint64 from, bool backward, qint64 &length) const;
+    QString decode(const QByteArray &data) const;
+    QByteArray encode(const QString &text) const;
+
+private:
+    class Piece
+    {
+    public:
+        bool added;
+        qint64 start;
+        qint64 length;
+        int lines;
+    };
+
+    bool map(const QString &filename);
+    const char * data(const Piece &piece) const;
+    int count(const Piece &piece, qint64 length) const;
+    qint64 nth(const Piece &piece, int n) const;
+    int split(qint64 pos);
+
+private:
+    QFile m_file;
+    const char *m_mapped;
+    QByteArray m_added;
+    QVector<qint64> m_breaks;
+    QList<Piece> m_pieces;
+    QTextCodec *m_codec;
+    QString m_error;
+    qint64 m_size;
+    int m_lines;
+    bool m_modified;
+};
+
+#endif // FB2PIECE_H
@@ -1,10 +1,19 @@
 #include "fb2read.hpp"
 
+#include <QSettings>
 #include <QtDebug>
 
+#include "fb2cache.h"
 #include "fb2imgs.hpp"
+#include "fb2logs.hpp"
+#include "fb2stat.hpp"
+#include "fb2utils.h"
 #include "fb2xml2.h"
 
+// Top-level sections of the main body rendered before the rest
+// are kept as fragments and collapsed into placeholders.
+#define FB2_LIVE_SECTIONS 3
+
 //---------------------------------------------------------------------------
 //  FbReadThread
 //---------------------------------------------------------------------------
@@ -20,6 +29,7 @@ FbReadThread::FbReadThread(QObject *parent, QXmlInputSource *source, QIODevice *
     : QThread(parent)
     , m_device(device)
     , m_source(source)
+    , m_cache(0)
 {
     m_store = new FbStore(this);
 }
@@ -32,23 +42,49 @@ FbReadThread::~FbReadThread()
 
 void FbReadThread::run()
 {
+    FbParseCache cache(m_device);
+    if (cache.load(m_html, m_store)) {
+        m_store->index().build(m_html, *m_store);
+        m_store->stats().count(m_store->index());
+        emit html(m_html, m_store);
+        deleteLater();
+        return;
+    }
+
+    m_html.clear();
+    m_cache = &cache;
     if (parse()) {
+        cache.save(m_html, m_store);
+        m_store->index().build(m_html, *m_store);
+        m_store->stats().count(m_store->index());
         emit html(m_html, m_store);
     } else {
         delete m_store;
     }
+    m_cache = 0;
     deleteLater();
 }
 
+void FbReadThread::addFile(const QString &name, const QByteArray &data)
+{
+    if (m_cache) m_cache->add(name, data);
+}
+
 bool FbReadThread::parse()
 {
     QXmlStreamWriter writer(&m_html);
     FbReadHandler handler(writer);
 
     connect(&handler, SIGNAL(binary(QString,QByteArray)), m_store, SLOT(binary(QString,QByteArray)));
-    connect(&handler, SIGNAL(warning(int,int,QString)), parent(), SIGNAL(warning(int,int,QString)));
-    connect(&handler, SIGNAL(error(int,int,QString)), parent(), SIGNAL(error(int,int,QString)));
-    connect(&handler, SIGNAL(fatal(int,int,QString)), parent(), SIGNAL(fatal(int,int,QString)));
+    connect(&handler, SIGNAL(binary(QString,QByteArray)), this, SLOT(addFile(QString,QByteArray)), Qt::DirectConnection);
+
+    // Diagnostics are collected here and sent to the page in batches
+    FbLogBuffer log;
+    connect(&handler, SIGNAL(warning(int,int,QString)), &log, SLOT(warning(int,int,QString)), Qt::DirectConnection);
+    connect(&handler, SIGNAL(error(int,int,QString)), &log, SLOT(error(int,int,QString)), Qt::DirectConnection);
+    connect(&handler, SIGNAL(fatal(int,int,QString)), &log, SLOT(fatal(int,int,QString)), Qt::DirectConnection);
+    connect(&log, SIGNAL(logged(QVariantList)), parent(), SIGNAL(logged(QVariantList)));
+    connect(&log, SIGNAL(failed(int,int)), parent(), SIGNAL(parseFailed(int,int)));
 
 #ifdef FB2_USE_LIBXML2
     XML2::XmlReader reader;
@@ -60,19 +96,24 @@ bool FbReadThread::parse()
     reader.setLexicalHandler(&handler);
     reader.setErrorHandler(&handler);
 
+    bool ok;
 #ifdef FB2_USE_LIBXML2
     if (m_device) {
-        return reader.parse(m_device);
+        ok = reader.parse(m_device);
     } else {
-        return reader.parse(m_source);
+        ok = reader.parse(m_source);
     }
 #else
     if (m_device) {
         m_source = new QXmlInputSource();
         m_source->setData(m_device->readAll());
     }
-    return reader.parse(m_source);
+    ok = reader.parse(m_source);
 #endif
+    log.flush();
+    m_store->setFragments(handler.fragments());
+    m_store->setNodes(handler.nodes());
+    return ok;
 }
 
 /*
@@ -205,6 +246,9 @@ void FbReadHandler::RootHandler::writeHeader()
 
     writeScript("qrc:/js/jquery.js");
     writeScript("qrc:/js/location.js");
+    writeScript("qrc:/js/lazy_load.js");
+    writeScript("qrc:/js/fix_contents.js");
+    writeScript("qrc:/js/fragments.js");
     if (!m_style.isEmpty()) {
         writer().writeStartElement("style");
         writer().writeAttribute("type", "text/css");
@@ -258,12 +302,17 @@ FB2_BEGIN_KEYHASH(FbReadHandler::TextHandler)
     FB2_KEY( Sub     , "sub"           );
     FB2_KEY( Sup     , "sup"           );
     FB2_KEY( Code    , "code"          );
+
+    FB2_KEY( Body    , "body"          );
+    FB2_KEY( Section , "section"       );
 FB2_END_KEYHASH
 
 FbReadHandler::TextHandler::TextHandler(FbReadHandler &owner, const QString &name, const QXmlAttributes &atts, const QString &tag)
     : BaseHandler(owner, name)
     , m_parent(NULL)
     , m_tag(tag)
+    , m_fragment(-1)
+    , m_virtual(false)
     , m_empty(true)
 {
     Init(name, atts);
@@ -273,6 +322,8 @@ FbReadHandler::TextHandler::TextHandler(TextHandler *parent, const QString &name
     : BaseHandler(parent->m_owner, name)
     , m_parent(parent)
     , m_tag(tag)
+    , m_fragment(-1)
+    , m_virtual(false)
     , m_empty(true)
 {
     Init(name, atts);
@@ -287,7 +338,7 @@ void FbReadHandler::TextHandler::Init(const QString &name, const QXmlAttributes
         QString name = atts.qName(i);
         switch (key) {
             case Anchor: { if (atts.localName(i) == "href") name = "href"; break; }
-            case Image:  { if (atts.localName(i) == "href") name = "src"; break; }
+            case Image:  { if (atts.localName(i) == "href") name = "data-src"; break; }
             default: ;
         }
         writer().writeAttribute(name, atts.value(i));
@@ -295,11 +346,22 @@ void FbReadHandler::TextHandler::Init(const QString &name, const QXmlAttributes
     if (m_tag == "p" && (name == "text-author" || name == "subtitle")) {
         writer().writeAttribute("fb:class", name);
     }
+    if (m_tag.left(3) == "fb:" || m_tag == "img") {
+        writer().writeAttribute("data-node", QString::number(++m_owner.m_nodes));
+    }
+    if (key == Body) {
+        m_style = Value(atts, "name");
+    } else if (key == Section && m_parent && m_parent->m_tag == "fb:body") {
+        m_virtual = m_parent->m_style.isEmpty() && m_owner.isVirtual();
+    }
 }
 
 FbXmlHandler::NodeHandler * FbReadHandler::TextHandler::NewTag(const QString &name, const QXmlAttributes &atts)
 {
     m_empty = false;
+    if (m_virtual && m_fragment < 0 && name != "title") {
+        m_fragment = m_owner.beginFragment();
+    }
     QString tag;
     switch (toKeyword(name)) {
         case Origin : tag = name;   break;
@@ -333,6 +395,7 @@ void FbReadHandler::TextHandler::EndTag(const QString &name)
             writer().writeCharacters("");
         }
     }
+    if (m_fragment >= 0) m_owner.endFragment();
     writer().writeEndElement();
 }
 
@@ -388,10 +451,49 @@ bool FbReadHandler::load(QObject *page, QXmlInputSource &source, QString &html)
     return reader.parse(source);
 }
 
+QString FbReadHandler::section(const QString &xml, int &nodes)
+{
+    // The xml holds a single top-level section wrapped into FictionBook
+    // and body, node ids continue from the given number.
+    QString html;
+    {
+        QXmlStreamWriter writer(&html);
+        FbReadHandler handler(writer);
+        handler.m_virtual = false;
+        handler.m_nodes = nodes;
+
+#ifdef FB2_USE_LIBXML2
+        XML2::XmlReader reader;
+#else
+        QXmlSimpleReader reader;
+#endif
+
+        reader.setContentHandler(&handler);
+        reader.setLexicalHandler(&handler);
+        reader.setErrorHandler(&handler);
+
+        QXmlInputSource source;
+        source.setData(xml);
+        if (!reader.parse(source)) return QString();
+        nodes = handler.m_nodes;
+    }
+
+    int begin = html.indexOf("<fb:section");
+    int end = html.lastIndexOf("</fb:section>");
+    if (begin < 0 || end < begin) return QString();
+    return html.mid(begin, end - begin + 13);
+}
+
 FbReadHandler::FbReadHandler(QXmlStreamWriter &writer)
     : FbXmlHandler()
     , m_writer(writer)
+    , m_fragment(0)
+    , m_sections(0)
+    , m_nodes(0)
 {
+    QSettings settings;
+    m_virtual = settings.value("text/virtual", false).toBool();
+
     m_writer.setAutoFormatting(true);
     m_writer.setAutoFormattingIndent(2);
     m_writer.writeStartElement("html");
@@ -399,6 +501,7 @@ FbReadHandler::FbReadHandler(QXmlStreamWriter &writer)
 
 FbReadHandler::~FbReadHandler()
 {
+    if (m_fragment) delete m_fragment;
     m_writer.writeEndElement();
 }
 
@@ -412,7 +515,7 @@ FbXmlHandler::NodeHandler * FbReadHandler::CreateRoot(const QString &name, const
 
 bool FbReadHandler::comment(const QString& ch)
 {
-    m_writer.writeComment(ch);
+    writer().writeComment(ch);
     return true;
 }
 
@@ -420,3 +523,36 @@ void FbReadHandler::addFile(const QString &name, const QByteArray &data)
 {
     emit binary(name, data);
 }
+
+bool FbReadHandler::isVirtual()
+{
+    return m_virtual && ++m_sections > FB2_LIVE_SECTIONS;
+}
+
+int FbReadHandler::beginFragment()
+{
+    if (m_fragment) return -1;
+    m_buffer.clear();
+    m_fragment = new QXmlStreamWriter(&m_buffer);
+    m_fragment->setAutoFormatting(true);
+    m_fragment->setAutoFormattingIndent(2);
+    return m_fragments.count();
+}
+
+void FbReadHandler::endFragment()
+{
+    FB2DELETE(m_fragment);
+    int index = m_fragments.count();
+    m_fragments.append(m_buffer);
+
+    // Rough height of the collapsed text, the page script
+    // measures the real one when a section is folded back.
+    int height = 20 * (1 + m_buffer.length() / 150);
+
+    m_writer.writeStartElement("div");
+    m_writer.writeAttribute("data-fragment", QString::number(index));
+    m_writer.writeAttribute("style", QString("height:%1px").arg(height));
+    m_writer.writeCharacters("");
+    m_writer.writeEndElement();
+    m_buffer.clear();
+}
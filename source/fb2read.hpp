@@ -5,9 +5,11 @@
 
 #include <QByteArray>
 #include <QMutex>
+#include <QStringList>
 #include <QThread>
 #include <QXmlDefaultHandler>
 
+class FbParseCache;
 class FbStore;
 
 class FbReadThread : public QThread
@@ -26,6 +28,9 @@ signals:
 protected:
     void run();
 
+private slots:
+    void addFile(const QString &name, const QByteArray &data);
+
 private:
     explicit FbReadThread(QObject *parent, QXmlInputSource *source, QIODevice *device);
     bool parse();
@@ -33,6 +38,7 @@ private:
 private:
     QIODevice *m_device;
     QXmlInputSource *m_source;
+    FbParseCache *m_cache;
     FbStore *m_store;
     QString m_html;
 };
@@ -43,10 +49,13 @@ class FbReadHandler : public FbXmlHandler
 
 public:
     static bool load(QObject *page, QXmlInputSource &source, QString &html);
+    static QString section(const QString &xml, int &nodes);
     explicit FbReadHandler(QXmlStreamWriter &writer);
     virtual ~FbReadHandler();
     virtual bool comment(const QString& ch);
-    QXmlStreamWriter & writer() { return m_writer; }
+    QXmlStreamWriter & writer() { return m_fragment ? *m_fragment : m_writer; }
+    const QStringList & fragments() const { return m_fragments; }
+    int nodes() const { return m_nodes; }
 
 private:
     class BaseHandler : public NodeHandler
@@ -105,6 +114,8 @@ private:
             Sub,
             Sup,
             Code,
+            Body,
+            Section,
        FB2_END_KEYLIST
     public:
         explicit TextHandler(FbReadHandler &owner, const QString &name, const QXmlAttributes &atts, const QString &tag);
@@ -120,6 +131,8 @@ private:
         TextHandler *m_parent;
         QString m_tag;
         QString m_style;
+        int m_fragment;
+        bool m_virtual;
         bool m_empty;
     };
 
@@ -143,11 +156,20 @@ protected:
 
 private:
     void addFile(const QString &name, const QByteArray &data);
+    bool isVirtual();
+    int beginFragment();
+    void endFragment();
 
 private:
     typedef QHash<QString, QString> StringHash;
     QXmlStreamWriter &m_writer;
+    QXmlStreamWriter *m_fragment;
+    QStringList m_fragments;
+    QString m_buffer;
     StringHash m_hash;
+    int m_sections;
+    int m_nodes;
+    bool m_virtual;
 };
 
 #endif // FB2READ_H
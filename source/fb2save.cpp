@@ -21,6 +21,7 @@
 #include <QTextCodec>
 #include <QWebFrame>
 #include <QWebPage>
+#include <QXmlStreamReader>
 #include <QtDebug>
 
 //---------------------------------------------------------------------------
@@ -141,6 +142,8 @@ FbSaveWriter::FbSaveWriter(FbTextEdit &view, QByteArray *array)
     : QXmlStreamWriter(array)
     , m_view(view)
     , m_string(0)
+    , m_section(-1)
+    , m_elided(false)
     , m_anchor(0)
     , m_focus(0)
 {
@@ -153,6 +156,8 @@ FbSaveWriter::FbSaveWriter(FbTextEdit &view, QIODevice *device)
     : QXmlStreamWriter(device)
     , m_view(view)
     , m_string(0)
+    , m_section(-1)
+    , m_elided(false)
     , m_anchor(0)
     , m_focus(0)
 {
@@ -162,6 +167,8 @@ FbSaveWriter::FbSaveWriter(FbTextEdit &view, QString *string)
     : QXmlStreamWriter(string)
     , m_view(view)
     , m_string(string)
+    , m_section(-1)
+    , m_elided(false)
     , m_anchor(0)
     , m_focus(0)
 {
@@ -221,6 +228,10 @@ QString FbSaveWriter::append(const QString &name)
     if (m_names.indexOf(name) < 0) {
         m_names.append(name);
     }
+    if (m_section >= 0) {
+        QStringList &names = m_sections[m_section].names;
+        if (names.indexOf(name) < 0) names.append(name);
+    }
     return name;
 }
 
@@ -278,8 +289,14 @@ void FbSaveWriter::writeFiles()
         writeStartElement("binary", 2);
         writeAttribute("id", name);
         QByteArray array = file->data();
-        QString data = array.toBase64();
         writeContentType(name, array);
+        if (m_elided) {
+            // No line end here, FbSyncMap::folded() expects a single line
+            QXmlStreamWriter::writeComment(QString(" %1 bytes ").arg(array.size()));
+            QXmlStreamWriter::writeEndElement();
+            continue;
+        }
+        QString data = array.toBase64();
         writeLineEnd();
         int pos = 0;
         while (true) {
@@ -307,6 +324,42 @@ void FbSaveWriter::writeContentType(const QString &name, QByteArray &data)
     writeAttribute("content-type", type);
 }
 
+void FbSaveWriter::beginSection(int id)
+{
+    // Ranges of top-level sections in the written text, they start
+    // right after the markup of the previous node.
+    if (!m_string) return;
+    QXmlStreamWriter::writeCharacters(QString());
+    FbSaveSection section;
+    section.id = id;
+    section.start = section.end = m_string->length();
+    section.skipped = false;
+    m_section = m_sections.count();
+    m_sections.append(section);
+}
+
+void FbSaveWriter::endSection()
+{
+    if (m_section < 0) return;
+    m_sections[m_section].end = m_string->length();
+    m_section = -1;
+}
+
+void FbSaveWriter::skipSection(int id)
+{
+    // The section text is kept by the caller, only the images
+    // it refers to are still written into the binaries.
+    if (!m_string) return;
+    QXmlStreamWriter::writeCharacters(QString());
+    FbSaveSection section;
+    section.id = id;
+    section.start = section.end = m_string->length();
+    section.skipped = true;
+    section.names = m_skip.value(id);
+    m_sections.append(section);
+    foreach (const QString &name, section.names) append(name);
+}
+
 void FbSaveWriter::setAnchor(int offset)
 {
     if (m_string) m_anchor = m_string->length() + offset;
@@ -368,10 +421,14 @@ void FbSaveHandler::TextHandler::writeAtts(const QXmlAttributes &atts)
     for (int i = 0; i < count; i++) {
         QString name = atts.qName(i);
         QString value = atts.value(i);
+        if (name.startsWith("data-") && name != "data-src") continue;
         if (m_tag == "image") {
-            if (name == "src") {
+            if (name == "src" || name == "data-src") {
+                if (name == "src" && atts.index("data-src") >= 0) continue;
                 name = "l:href";
                 value = m_writer.filename(value).prepend('#');
+            } else if (name == "width" || name == "height") {
+                continue;
             }
         } else if (m_tag == "a") {
             if (name == "href") name = "l:href";
@@ -383,6 +440,9 @@ void FbSaveHandler::TextHandler::writeAtts(const QXmlAttributes &atts)
 FbXmlHandler::NodeHandler * FbSaveHandler::TextHandler::NewTag(const QString &name, const QXmlAttributes &atts)
 {
     m_hasChild = true;
+    if (m_level == 2 && name == "fb:section") {
+        m_writer.beginSection(Value(atts, "data-node").toInt());
+    }
     QString tag = QString();
     switch (toKeyword(name)) {
         case Origin    : tag = name; break;
@@ -410,6 +470,7 @@ void FbSaveHandler::TextHandler::EndTag(const QString &name)
     Q_UNUSED(name);
     if (m_tag.isEmpty()) return;
     m_writer.writeEndElement(m_hasChild ? m_level : 0);
+    if (m_level == 3 && m_tag == "section") m_writer.endSection();
 }
 
 int FbSaveHandler::TextHandler::nextLevel() const
@@ -543,6 +604,47 @@ void FbSaveHandler::onFocus(int offset)
     m_writer.setFocus(offset - m_lastTextLength);
 }
 
+void FbSaveHandler::onFragment(int index)
+{
+    FbStore *store = m_writer.view().store();
+    if (!store) return;
+
+    // Replays a collapsed section as if it was walked in the page
+    QXmlStreamReader reader("<fragment>" + store->fragment(index) + "</fragment>");
+    reader.setNamespaceProcessing(false);
+    int depth = 0;
+    while (!reader.atEnd()) {
+        switch (reader.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                if (depth++ == 0) break;
+                foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+                    onAttr(attr.qualifiedName().toString(), attr.value().toString());
+                }
+                onNew(reader.qualifiedName().toString());
+            } break;
+            case QXmlStreamReader::EndElement: {
+                if (--depth == 0) break;
+                onEnd(reader.qualifiedName().toString());
+            } break;
+            case QXmlStreamReader::Characters: {
+                if (depth > 1) onTxt(reader.text().toString());
+            } break;
+            case QXmlStreamReader::Comment: {
+                onCom(reader.text().toString());
+            } break;
+            default: ;
+        }
+    }
+    if (reader.hasError()) {
+        qCritical() << QObject::tr("Fragment %1: %2").arg(index).arg(reader.errorString());
+    }
+}
+
+void FbSaveHandler::onSkip(int id)
+{
+    m_writer.skipSection(id);
+}
+
 FbXmlHandler::NodeHandler * FbSaveHandler::CreateRoot(const QString &name, const QXmlAttributes &atts)
 {
     Q_UNUSED(atts);
@@ -580,9 +682,10 @@ bool FbSaveHandler::save()
 
     m_writer.writeStartDocument();
     if (page->isModified()) setDocumentInfo(frame);
-    QString javascript = jScript("export.js");
+    QStringList skip;
+    foreach (int id, m_writer.skipped().keys()) skip << QString("%1:1").arg(id);
     frame->addToJavaScriptWindowObject("handler", this);
-    frame->evaluateJavaScript(javascript);
+    frame->evaluateJavaScript(QString("FbExport(document,{%1})").arg(skip.join(",")));
     m_writer.writeEndDocument();
 
     return true;
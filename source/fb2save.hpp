@@ -6,6 +6,7 @@
 
 #include <QByteArray>
 #include <QFileDialog>
+#include <QHash>
 #include <QStringList>
 #include <QXmlStreamWriter>
 
@@ -18,6 +19,20 @@ QT_END_NAMESPACE
 
 class FbTextEdit;
 
+class FbSaveSection
+{
+public:
+    int id;
+    int start;
+    int end;
+    bool skipped;
+    QStringList names;
+};
+
+typedef QList<FbSaveSection> FbSaveSections;
+
+typedef QHash<int, QStringList> FbSkipHash;
+
 class FbSaveDialog : public QFileDialog
 {
     Q_OBJECT
@@ -86,6 +101,14 @@ public:
     int focus() const { return m_focus; }
     void setAnchor(int offset);
     void setFocus(int offset);
+public:
+    void setElided(bool elided) { m_elided = elided; }
+    void setSkipped(const FbSkipHash &skip) { m_skip = skip; }
+    const FbSkipHash & skipped() const { return m_skip; }
+    const FbSaveSections & sections() const { return m_sections; }
+    void beginSection(int id);
+    void endSection();
+    void skipSection(int id);
 private:
     QByteArray downloadFile(const QUrl &url);
     void writeContentType(const QString &name, QByteArray &data);
@@ -95,6 +118,10 @@ private:
     QStringList m_names;
     QString *m_string;
     QString m_style;
+    FbSkipHash m_skip;
+    FbSaveSections m_sections;
+    int m_section;
+    bool m_elided;
     int m_anchor;
     int m_focus;
 };
@@ -111,6 +138,8 @@ public:
 public slots:
     void onAnchor(int offset);
     void onFocus(int offset);
+    void onFragment(int index);
+    void onSkip(int id);
 
 private:
     class TextHandler : public NodeHandler
@@ -0,0 +1,526 @@
+#include "fb2srch.hpp"
+
+#include <climits>
+
+#include <QApplication>
+#include <QCheckBox>
+#include <QElapsedTimer>
+#include <QGridLayout>
+#include <QHash>
+#include <QLabel>
+#include <QLineEdit>
+#include <QListWidget>
+#include <QPushButton>
+#include <QRegularExpression>
+#include <QVBoxLayout>
+#include <QtDebug>
+#include <QXmlStreamReader>
+
+#include "fb2imgs.hpp"
+#include "fb2page.hpp"
+#include "fb2text.hpp"
+
+//---------------------------------------------------------------------------
+//  FbTextIndex::Builder
+//---------------------------------------------------------------------------
+
+class FbTextIndex::Builder
+{
+public:
+    explicit Builder(const FbStore &store) : m_store(store) {}
+    void parse(const QString &html);
+    void parse(const QVariantList &list);
+    QList<Entry> & entries() { return m_entries; }
+    QList<Mark> & marks() { return m_marks; }
+
+private:
+    class Scope
+    {
+    public:
+        QString tag;
+        int node;
+        int root;
+    };
+    void parse(QXmlStreamReader &reader, QList<Scope> &stack, int fragment);
+    void expand(const Scope &scope, int index);
+    void append(const Scope &scope, int fragment, const QString &text);
+    void mark(int root, const QString &tag);
+    QString text(QXmlStreamReader &reader, int root);
+
+private:
+    const FbStore &m_store;
+    QList<Entry> m_entries;
+    QList<Mark> m_marks;
+    QHash<int, int> m_numbers;
+};
+
+void FbTextIndex::Builder::append(const Scope &scope, int fragment, const QString &text)
+{
+    Entry entry;
+    entry.root = scope.root;
+    entry.node = scope.node;
+    entry.number = m_numbers[scope.node]++;
+    entry.fragment = fragment;
+    entry.text = text;
+    entry.fold = FbTextIndex::fold(text, false, false);
+    m_entries.append(entry);
+}
+
+void FbTextIndex::Builder::mark(int root, const QString &tag)
+{
+    Mark mark;
+    mark.root = root;
+    mark.tag = tag;
+    m_marks.append(mark);
+}
+
+QString FbTextIndex::Builder::text(QXmlStreamReader &reader, int root)
+{
+    // Same as readElementText(), marking inline images on the way
+    QString result;
+    int depth = 1;
+    while (depth && !reader.atEnd()) {
+        switch (reader.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                if (reader.qualifiedName() == "img") mark(root, "img");
+                depth++;
+            } break;
+            case QXmlStreamReader::EndElement: {
+                depth--;
+            } break;
+            case QXmlStreamReader::Characters:
+            case QXmlStreamReader::EntityReference: {
+                result += reader.text();
+            } break;
+            default: ;
+        }
+    }
+    return result;
+}
+
+void FbTextIndex::Builder::parse(const QString &html)
+{
+    QXmlStreamReader reader(html);
+    reader.setNamespaceProcessing(false);
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (reader.isStartElement() && reader.qualifiedName() == "body") {
+            QList<Scope> stack;
+            Scope scope;
+            scope.node = scope.root = 0;
+            stack.append(scope);
+            parse(reader, stack, -1);
+            break;
+        }
+    }
+}
+
+void FbTextIndex::Builder::parse(QXmlStreamReader &reader, QList<Scope> &stack, int fragment)
+{
+    // Paragraphs are numbered within the nearest element carrying
+    // a node id, the same way as FbIndex() walks the live document.
+    int depth = stack.count();
+    while (!reader.atEnd()) {
+        switch (reader.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                const Scope &top = stack.last();
+                QStringRef tag = reader.qualifiedName();
+                QXmlStreamAttributes atts = reader.attributes();
+                if (tag == "p") {
+                    append(top, fragment, text(reader, top.root));
+                } else if (atts.hasAttribute("data-fragment")) {
+                    expand(top, atts.value("data-fragment").toString().toInt());
+                    reader.skipCurrentElement();
+                } else if (tag == "fb:description") {
+                    reader.skipCurrentElement();
+                } else {
+                    Scope scope;
+                    scope.tag = tag.toString();
+                    scope.node = atts.hasAttribute("data-node") ? atts.value("data-node").toString().toInt() : top.node;
+                    scope.root = top.root;
+                    if (tag == "fb:body" || (tag == "fb:section" && top.tag == "fb:body")) scope.root = scope.node;
+                    if (tag == "fb:body" || tag == "fb:section" || tag == "img") mark(scope.root, scope.tag);
+                    stack.append(scope);
+                }
+            } break;
+            case QXmlStreamReader::EndElement: {
+                if (stack.count() <= depth) return;
+                stack.removeLast();
+            } break;
+            default: ;
+        }
+    }
+}
+
+void FbTextIndex::Builder::expand(const Scope &scope, int index)
+{
+    QXmlStreamReader reader;
+    reader.setNamespaceProcessing(false);
+    reader.addData("<fragment>");
+    reader.addData(m_store.fragment(index));
+    reader.addData("</fragment>");
+    while (!reader.atEnd() && !reader.isStartElement()) reader.readNext();
+    QList<Scope> stack;
+    stack.append(scope);
+    parse(reader, stack, index);
+}
+
+void FbTextIndex::Builder::parse(const QVariantList &list)
+{
+    // The list is a flat sequence of (root, node, fragment, text)
+    // quadruples, collapsed sections are passed by fragment index,
+    // bodies, sections and images by fragment -2 and the tag name.
+    int count = list.count() / 4;
+    for (int i = 0; i < count; i++) {
+        Scope scope;
+        scope.root = list[i * 4].toInt();
+        scope.node = list[i * 4 + 1].toInt();
+        scope.tag = "fb:section";
+        int index = list[i * 4 + 2].toInt();
+        if (index == -2) {
+            mark(scope.root, list[i * 4 + 3].toString());
+        } else if (index < 0) {
+            append(scope, -1, list[i * 4 + 3].toString());
+        } else {
+            expand(scope, index);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+//  FbTextIndex
+//---------------------------------------------------------------------------
+
+static QString expand(const QString &after, const QString &text, const QRegularExpressionMatch &match)
+{
+    // Groups are taken from the original text, the match itself
+    // may have been made against the folded copy.
+    QString result;
+    int count = after.length();
+    for (int i = 0; i < count; i++) {
+        QChar c = after.at(i);
+        if (c == '\\' && i + 1 < count) {
+            QChar n = after.at(++i);
+            if (n.isDigit()) {
+                int group = n.digitValue();
+                if (group <= match.lastCapturedIndex() && match.capturedStart(group) >= 0) {
+                    result += text.mid(match.capturedStart(group), match.capturedLength(group));
+                }
+            } else if (n == 'n') {
+                result += '\n';
+            } else if (n == 't') {
+                result += '\t';
+            } else {
+                result += n;
+            }
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+QString FbTextIndex::fold(const QString &text, bool cs, bool marks)
+{
+    // Folding keeps one character per character, so that offsets
+    // found in the folded text are valid in the original one.
+    QString result = text;
+    QChar *c = result.data();
+    QChar *end = c + result.size();
+    for (; c != end; ++c) {
+        if (!marks) {
+            while (c->decompositionTag() == QChar::Canonical) {
+                QString d = c->decomposition();
+                if (d.size() < 2 || d.at(1).category() != QChar::Mark_NonSpacing) break;
+                *c = d.at(0);
+            }
+        }
+        if (!cs) *c = c->toCaseFolded();
+    }
+    return result;
+}
+
+void FbTextIndex::build(const QString &html, const FbStore &store)
+{
+    Builder builder(store);
+    builder.parse(html);
+    m_entries = builder.entries();
+    m_marks = builder.marks();
+}
+
+void FbTextIndex::build(const QVariantList &list, const FbStore &store)
+{
+    Builder builder(store);
+    builder.parse(list);
+    m_entries = builder.entries();
+    m_marks = builder.marks();
+}
+
+bool FbTextIndex::replace(int root, const QVariantList &list, const FbStore &store)
+{
+    int first = -1;
+    int last = -1;
+    int fragment = -1;
+    int count = m_entries.count();
+    for (int i = 0; i < count; i++) {
+        const Entry &entry = m_entries.at(i);
+        if (entry.root != root) {
+            if (first >= 0) break;
+            continue;
+        }
+        if (first < 0) first = i;
+        if (entry.fragment >= 0) fragment = entry.fragment;
+        last = i;
+    }
+    if (first < 0) return false;
+
+    int mark = -1;
+    int marks = 0;
+    for (int i = 0; i < m_marks.count(); i++) {
+        if (m_marks.at(i).root != root) {
+            if (mark >= 0) break;
+            continue;
+        }
+        if (mark < 0) mark = i;
+        marks++;
+    }
+    if (mark < 0) return false;
+
+    Builder builder(store);
+    builder.parse(list);
+    QList<Entry> &entries = builder.entries();
+
+    // A section keeps its fragment index once expanded, in case
+    // it is folded back before a search result is activated.
+    for (int i = 0; i < entries.count(); i++) {
+        if (entries[i].fragment < 0) entries[i].fragment = fragment;
+    }
+
+    m_entries = m_entries.mid(0, first) + entries + m_entries.mid(last + 1);
+    m_marks = m_marks.mid(0, mark) + builder.marks() + m_marks.mid(mark + marks);
+    return true;
+}
+
+QList<FbTextIndex::Match> FbTextIndex::find(const QString &text, Options options, int limit, const QString *after) const
+{
+    QList<Match> result;
+    if (text.isEmpty()) return result;
+
+    const bool cs = options & CaseSensitive;
+    const bool marks = options & Diacritics;
+
+    // Entries keep a case folded copy only, matching case while
+    // ignoring diacritics folds the text of each entry anew.
+    const bool refold = cs && !marks;
+
+    if (options & (RegExp | WholeWords)) {
+        // The pattern is folded like the text it runs on; an expression
+        // keeps its case, so that escapes such as \D stay what they are.
+        QString needle = marks ? text : fold(text, cs || (options & RegExp), false);
+        QString pattern = options & RegExp ? needle : QRegularExpression::escape(needle);
+        if (options & WholeWords) pattern = "\\b(?:" + pattern + ")\\b";
+        QRegularExpression::PatternOptions flags = QRegularExpression::UseUnicodePropertiesOption;
+        if (!cs) flags |= QRegularExpression::CaseInsensitiveOption;
+        QRegularExpression regexp(pattern, flags);
+        if (!regexp.isValid()) return result;
+        int count = m_entries.count();
+        for (int i = 0; i < count; i++) {
+            const Entry &entry = m_entries.at(i);
+            QString haystack = marks ? entry.text : refold ? fold(entry.text, true, false) : entry.fold;
+            QRegularExpressionMatchIterator it = regexp.globalMatch(haystack);
+            while (it.hasNext()) {
+                QRegularExpressionMatch match = it.next();
+                if (match.capturedLength() == 0) continue;
+                Match m = { i, match.capturedStart(), match.capturedLength() };
+                if (after) m.text = options & RegExp ? expand(*after, entry.text, match) : *after;
+                result.append(m);
+                if (result.count() >= limit) return result;
+            }
+        }
+    } else {
+        QString needle = marks ? text : fold(text, cs, false);
+        Qt::CaseSensitivity sensitivity = cs ? Qt::CaseSensitive : Qt::CaseInsensitive;
+        int count = m_entries.count();
+        for (int i = 0; i < count; i++) {
+            const Entry &entry = m_entries.at(i);
+            QString haystack = marks ? entry.text : refold ? fold(entry.text, true, false) : entry.fold;
+            int pos = haystack.indexOf(needle, 0, sensitivity);
+            while (pos >= 0) {
+                Match m = { i, pos, needle.length() };
+                if (after) m.text = *after;
+                result.append(m);
+                if (result.count() >= limit) return result;
+                pos = haystack.indexOf(needle, pos + needle.length(), sensitivity);
+            }
+        }
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------
+//  FbSearchWidget
+//---------------------------------------------------------------------------
+
+FbSearchWidget::FbSearchWidget(FbTextEdit *text, QWidget *parent)
+    : QWidget(parent)
+    , m_text(text)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setSpacing(4);
+    layout->setContentsMargins(0, 0, 0, 0);
+
+    m_edit = new QLineEdit(this);
+    m_edit->setPlaceholderText(tr("Find text"));
+    layout->addWidget(m_edit);
+
+    QHBoxLayout *row = new QHBoxLayout;
+    m_replace = new QLineEdit(this);
+    m_replace->setPlaceholderText(tr("Replace with"));
+    m_button = new QPushButton(tr("Replace all"), this);
+    row->addWidget(m_replace);
+    row->addWidget(m_button);
+    layout->addLayout(row);
+
+    QGridLayout *grid = new QGridLayout;
+    m_case = new QCheckBox(tr("Match case"), this);
+    m_marks = new QCheckBox(tr("Match diacritics"), this);
+    m_regexp = new QCheckBox(tr("Regular expression"), this);
+    m_words = new QCheckBox(tr("Whole words"), this);
+    m_marks->setChecked(true);
+    grid->addWidget(m_case, 0, 0);
+    grid->addWidget(m_marks, 0, 1);
+    grid->addWidget(m_regexp, 1, 0);
+    grid->addWidget(m_words, 1, 1);
+    layout->addLayout(grid);
+
+    m_list = new QListWidget(this);
+    m_list->setWordWrap(true);
+    m_list->setAlternatingRowColors(true);
+    layout->addWidget(m_list);
+
+    m_label = new QLabel(this);
+    layout->addWidget(m_label);
+
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(300);
+
+    connect(&m_timer, SIGNAL(timeout()), SLOT(search()));
+    connect(m_edit, SIGNAL(textChanged(QString)), &m_timer, SLOT(start()));
+    connect(m_edit, SIGNAL(returnPressed()), SLOT(search()));
+    connect(m_button, SIGNAL(clicked()), SLOT(replace()));
+    connect(m_case, SIGNAL(toggled(bool)), SLOT(search()));
+    connect(m_marks, SIGNAL(toggled(bool)), SLOT(search()));
+    connect(m_regexp, SIGNAL(toggled(bool)), SLOT(search()));
+    connect(m_words, SIGNAL(toggled(bool)), SLOT(search()));
+    connect(m_list, SIGNAL(itemActivated(QListWidgetItem*)), SLOT(activated(QListWidgetItem*)));
+    connect(m_text->page(), SIGNAL(indexChanged()), &m_timer, SLOT(start()));
+}
+
+void FbSearchWidget::activate(bool replace)
+{
+    QLineEdit *edit = replace && !m_edit->text().isEmpty() ? m_replace : m_edit;
+    edit->setFocus();
+    edit->selectAll();
+}
+
+FbTextIndex::Options FbSearchWidget::options() const
+{
+    FbTextIndex::Options options = 0;
+    if (m_case->isChecked()) options |= FbTextIndex::CaseSensitive;
+    if (m_marks->isChecked()) options |= FbTextIndex::Diacritics;
+    if (m_regexp->isChecked()) options |= FbTextIndex::RegExp;
+    if (m_words->isChecked()) options |= FbTextIndex::WholeWords;
+    return options;
+}
+
+void FbSearchWidget::search()
+{
+    m_timer.stop();
+    m_list->clear();
+    m_label->clear();
+
+    QString text = m_edit->text();
+    FbStore *store = m_text->store();
+    if (text.isEmpty() || !store) return;
+
+    if (m_regexp->isChecked() && !QRegularExpression(text).isValid()) {
+        m_label->setText(tr("Invalid regular expression"));
+        return;
+    }
+
+    const int limit = 1000;
+    QElapsedTimer timer;
+    timer.start();
+    const FbTextIndex &index = store->index();
+    QList<FbTextIndex::Match> matches = index.find(text, options(), limit);
+    qint64 elapsed = timer.elapsed();
+
+    foreach (const FbTextIndex::Match &match, matches) {
+        const FbTextIndex::Entry &entry = index.at(match.entry);
+        QListWidgetItem *item = new QListWidgetItem(snippet(entry.text, match.pos, match.len), m_list);
+        item->setData(Qt::UserRole + 0, entry.fragment);
+        item->setData(Qt::UserRole + 1, entry.node);
+        item->setData(Qt::UserRole + 2, entry.number);
+        item->setData(Qt::UserRole + 3, match.pos);
+        item->setData(Qt::UserRole + 4, match.len);
+    }
+
+    QString count = matches.count() < limit ? QString::number(matches.count()) : QString("%1+").arg(limit);
+    m_label->setText(tr("%1 matches in %2 paragraphs, %3 ms").arg(count).arg(index.count()).arg(elapsed));
+}
+
+void FbSearchWidget::replace()
+{
+    QString text = m_edit->text();
+    FbStore *store = m_text->store();
+    if (text.isEmpty() || !store) return;
+
+    if (m_regexp->isChecked() && !QRegularExpression(text).isValid()) {
+        m_label->setText(tr("Invalid regular expression"));
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    FbTextPage *page = m_text->page();
+    page->flushIndex();
+    const FbTextIndex &index = store->index();
+    QString after = m_replace->text();
+    QList<FbTextIndex::Match> matches = index.find(text, options(), INT_MAX, &after);
+    if (matches.isEmpty()) {
+        m_label->setText(tr("No matches"));
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    int count = page->replaceText(index, matches);
+    QApplication::restoreOverrideCursor();
+
+    QString message = tr("Replaced %1 matches in %2 paragraphs, %3 ms").arg(matches.count()).arg(count).arg(timer.elapsed());
+    m_list->clear();
+    m_label->setText(message);
+    qDebug() << message;
+}
+
+QString FbSearchWidget::snippet(const QString &text, int pos, int len) const
+{
+    const int context = 40;
+    int start = qMax(0, pos - context);
+    int end = qMin(text.length(), pos + len + context);
+    QString result = text.mid(start, end - start).simplified();
+    if (start > 0) result.prepend(QChar(0x2026));
+    if (end < text.length()) result.append(QChar(0x2026));
+    return result;
+}
+
+void FbSearchWidget::activated(QListWidgetItem *item)
+{
+    if (!item) return;
+    int fragment = item->data(Qt::UserRole + 0).toInt();
+    int node = item->data(Qt::UserRole + 1).toInt();
+    int number = item->data(Qt::UserRole + 2).toInt();
+    int pos = item->data(Qt::UserRole + 3).toInt();
+    int len = item->data(Qt::UserRole + 4).toInt();
+    m_text->page()->selectText(fragment, node, number, pos, len);
+    m_text->setFocus();
+}
@@ -0,0 +1,114 @@
+#ifndef FB2SRCH_H
+#define FB2SRCH_H
+
+#include <QList>
+#include <QString>
+#include <QTimer>
+#include <QVariant>
+#include <QWidget>
+
+QT_BEGIN_NAMESPACE
+class QCheckBox;
+class QLabel;
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+class QPushButton;
+QT_END_NAMESPACE
+
+class FbStore;
+class FbTextEdit;
+
+class FbTextIndex
+{
+public:
+    enum Option {
+        CaseSensitive = 0x01,
+        Diacritics    = 0x02,
+        RegExp        = 0x04,
+        WholeWords    = 0x08,
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    class Entry
+    {
+    public:
+        int root;
+        int node;
+        int number;
+        int fragment;
+        QString text;
+        QString fold;
+    };
+
+    class Mark
+    {
+    public:
+        int root;
+        QString tag;
+    };
+
+    class Match
+    {
+    public:
+        int entry;
+        int pos;
+        int len;
+        QString text;
+    };
+
+    static QString fold(const QString &text, bool cs, bool marks);
+
+public:
+    FbTextIndex() {}
+    void build(const QString &html, const FbStore &store);
+    void build(const QVariantList &list, const FbStore &store);
+    bool replace(int root, const QVariantList &list, const FbStore &store);
+    QList<Match> find(const QString &text, Options options, int limit, const QString *after = 0) const;
+    const Entry & at(int index) const { return m_entries.at(index); }
+    int count() const { return m_entries.count(); }
+    const QList<Mark> & marks() const { return m_marks; }
+    void clear() { m_entries.clear(); m_marks.clear(); }
+
+private:
+    class Builder;
+
+private:
+    QList<Entry> m_entries;
+    QList<Mark> m_marks;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FbTextIndex::Options)
+
+class FbSearchWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FbSearchWidget(FbTextEdit *text, QWidget *parent = 0);
+    void activate(bool replace = false);
+
+private slots:
+    void search();
+    void replace();
+    void activated(QListWidgetItem *item);
+
+private:
+    FbTextIndex::Options options() const;
+    QString snippet(const QString &text, int pos, int len) const;
+
+private:
+    FbTextEdit *m_text;
+    QLineEdit *m_edit;
+    QLineEdit *m_replace;
+    QPushButton *m_button;
+    QCheckBox *m_case;
+    QCheckBox *m_marks;
+    QCheckBox *m_regexp;
+    QCheckBox *m_words;
+    QLabel *m_label;
+    QListWidget *m_list;
+    QTimer m_timer;
+};
+
+#endif // FB2SRCH_H
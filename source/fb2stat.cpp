@@ -0,0 +1,222 @@
+#include "fb2stat.hpp"
+
+#include <QHeaderView>
+#include <QLabel>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include "fb2imgs.hpp"
+#include "fb2page.hpp"
+#include "fb2text.hpp"
+
+//---------------------------------------------------------------------------
+//  FbTextStats
+//---------------------------------------------------------------------------
+
+FbTextStats::Counts & FbTextStats::Counts::operator+=(const Counts &other)
+{
+    chars += other.chars;
+    words += other.words;
+    paragraphs += other.paragraphs;
+    sections += other.sections;
+    images += other.images;
+    return *this;
+}
+
+int FbTextStats::words(const QString &text)
+{
+    // A word is a run of letters and digits, hyphens and apostrophes
+    // between two letters do not break it.
+    int result = 0;
+    bool word = false;
+    const QChar *c = text.constData();
+    const QChar *end = c + text.size();
+    for (; c != end; ++c) {
+        if (c->isLetterOrNumber()) {
+            if (!word) result++;
+            word = true;
+        } else if (word && c + 1 != end && (c + 1)->isLetterOrNumber()) {
+            ushort u = c->unicode();
+            word = u == '-' || u == '\'' || u == 0x2019;
+        } else {
+            word = false;
+        }
+    }
+    return result;
+}
+
+void FbTextStats::count(const FbTextIndex &index, const QSet<int> &roots)
+{
+    // Only the listed top-level sections are recounted, the whole
+    // index if the list is empty or holds -1.
+    bool all = roots.isEmpty() || roots.contains(-1);
+    if (all) {
+        m_roots.clear();
+    } else {
+        foreach (int root, roots) m_roots.remove(root);
+    }
+
+    int count = index.count();
+    for (int i = 0; i < count; i++) {
+        const FbTextIndex::Entry &entry = index.at(i);
+        if (!all && !roots.contains(entry.root)) continue;
+        Counts &counts = m_roots[entry.root];
+        counts.chars += entry.text.length();
+        counts.words += words(entry.text);
+        counts.paragraphs++;
+    }
+
+    foreach (const FbTextIndex::Mark &mark, index.marks()) {
+        if (!all && !roots.contains(mark.root)) continue;
+        Counts &counts = m_roots[mark.root];
+        if (mark.tag == "fb:section") counts.sections++;
+        if (mark.tag == "img") counts.images++;
+    }
+}
+
+void FbTextStats::merge(const QSet<int> &roots, const QVariantList &list)
+{
+    // The list holds (root, chars, words, paragraphs, sections, images)
+    // tuples of the roots counted by FbTextCounter.
+    if (roots.contains(-1)) {
+        m_roots.clear();
+    } else {
+        foreach (int root, roots) m_roots.remove(root);
+    }
+    for (int i = 0; i + 5 < list.count(); i += 6) {
+        Counts &counts = m_roots[list.at(i).toInt()];
+        counts.chars = list.at(i + 1).toInt();
+        counts.words = list.at(i + 2).toInt();
+        counts.paragraphs = list.at(i + 3).toInt();
+        counts.sections = list.at(i + 4).toInt();
+        counts.images = list.at(i + 5).toInt();
+    }
+}
+
+QVariantList FbTextStats::toList() const
+{
+    QVariantList result;
+    QHash<int, Counts>::const_iterator it;
+    for (it = m_roots.constBegin(); it != m_roots.constEnd(); ++it) {
+        const Counts &counts = it.value();
+        result << it.key() << counts.chars << counts.words;
+        result << counts.paragraphs << counts.sections << counts.images;
+    }
+    return result;
+}
+
+QList<FbTextStats::Body> FbTextStats::bodies(const FbTextIndex &index) const
+{
+    // Top-level sections belong to the body marked before them
+    QList<Body> result;
+    QSet<int> done;
+    foreach (const FbTextIndex::Mark &mark, index.marks()) {
+        if (mark.tag == "fb:body") {
+            Body body;
+            body.root = mark.root;
+            result.append(body);
+        }
+        if (result.isEmpty() || done.contains(mark.root)) continue;
+        done.insert(mark.root);
+        result.last().counts += m_roots.value(mark.root);
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------
+//  FbTextCounter
+//---------------------------------------------------------------------------
+
+void FbTextCounter::execute(QObject *parent, int serial, const FbTextIndex &index, const QSet<int> &roots)
+{
+    FbTextCounter *thread = new FbTextCounter(parent, serial, index, roots);
+    connect(thread, SIGNAL(counted(int,QVariantList)), parent, SLOT(counted(int,QVariantList)));
+    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    thread->start();
+}
+
+FbTextCounter::FbTextCounter(QObject *parent, int serial, const FbTextIndex &index, const QSet<int> &roots)
+    : QThread(parent)
+    , m_index(index)
+    , m_roots(roots)
+    , m_serial(serial)
+{
+}
+
+void FbTextCounter::run()
+{
+    FbTextStats stats;
+    stats.count(m_index, m_roots);
+    emit counted(m_serial, stats.toList());
+}
+
+//---------------------------------------------------------------------------
+//  FbStatWidget
+//---------------------------------------------------------------------------
+
+FbStatWidget::FbStatWidget(FbTextEdit *text, QWidget *parent)
+    : QWidget(parent)
+    , m_text(text)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setSpacing(0);
+    layout->setContentsMargins(0, 0, 0, 0);
+
+    m_tree = new QTreeWidget(this);
+    m_tree->setRootIsDecorated(false);
+    m_tree->setHeaderLabels(QStringList()
+        << tr("Body")
+        << tr("Characters")
+        << tr("Words")
+        << tr("Paragraphs")
+        << tr("Sections")
+        << tr("Images")
+    );
+    m_tree->header()->setDefaultSectionSize(70);
+    layout->addWidget(m_tree);
+
+    m_label = new QLabel(this);
+    m_label->setMargin(4);
+    layout->addWidget(m_label);
+
+    connect(m_text, SIGNAL(loadFinished(bool)), SLOT(refresh()));
+    connect(m_text->page(), SIGNAL(statsChanged()), SLOT(refresh()));
+    refresh();
+}
+
+void FbStatWidget::refresh()
+{
+    // Counts are kept by the store, nothing is recounted here
+    m_tree->clear();
+    m_label->clear();
+    FbStore *store = m_text->store();
+    if (!store) return;
+
+    FbTextStats::Counts total;
+    QList<FbTextStats::Body> bodies = store->stats().bodies(store->index());
+    for (int i = 0; i < bodies.count(); i++) {
+        const FbTextStats::Counts &counts = bodies.at(i).counts;
+        QStringList columns;
+        columns << tr("Body %1").arg(i + 1);
+        columns << QString::number(counts.chars) << QString::number(counts.words);
+        columns << QString::number(counts.paragraphs) << QString::number(counts.sections);
+        columns << QString::number(counts.images);
+        new QTreeWidgetItem(m_tree, columns);
+        total += counts;
+    }
+
+    QStringList columns;
+    columns << tr("Total");
+    columns << QString::number(total.chars) << QString::number(total.words);
+    columns << QString::number(total.paragraphs) << QString::number(total.sections);
+    columns << QString::number(total.images);
+    QTreeWidgetItem *item = new QTreeWidgetItem(m_tree, columns);
+    QFont font = item->font(0);
+    font.setBold(true);
+    for (int i = 0; i < columns.count(); i++) item->setFont(i, font);
+
+    qint64 size = 0;
+    int count = store->count();
+    for (int i = 0; i < count; i++) size += store->at(i)->size();
+    m_label->setText(tr("Binaries: %1, %2 KB").arg(count).arg((size + 1023) >> 10));
+}
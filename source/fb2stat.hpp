@@ -0,0 +1,95 @@
+#ifndef FB2STAT_H
+#define FB2STAT_H
+
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QThread>
+#include <QVariant>
+#include <QWidget>
+
+#include "fb2srch.hpp"
+
+QT_BEGIN_NAMESPACE
+class QLabel;
+class QTreeWidget;
+QT_END_NAMESPACE
+
+class FbTextEdit;
+
+class FbTextStats
+{
+public:
+    class Counts
+    {
+    public:
+        Counts() : chars(0), words(0), paragraphs(0), sections(0), images(0) {}
+        Counts & operator+=(const Counts &other);
+        int chars;
+        int words;
+        int paragraphs;
+        int sections;
+        int images;
+    };
+
+    class Body
+    {
+    public:
+        int root;
+        Counts counts;
+    };
+
+    static int words(const QString &text);
+
+public:
+    FbTextStats() {}
+    void count(const FbTextIndex &index, const QSet<int> &roots = QSet<int>());
+    void merge(const QSet<int> &roots, const QVariantList &list);
+    QVariantList toList() const;
+    QList<Body> bodies(const FbTextIndex &index) const;
+    void clear() { m_roots.clear(); }
+
+private:
+    QHash<int, Counts> m_roots;
+};
+
+class FbTextCounter : public QThread
+{
+    Q_OBJECT
+
+public:
+    static void execute(QObject *parent, int serial, const FbTextIndex &index, const QSet<int> &roots);
+
+signals:
+    void counted(int serial, const QVariantList &counts);
+
+protected:
+    void run();
+
+private:
+    explicit FbTextCounter(QObject *parent, int serial, const FbTextIndex &index, const QSet<int> &roots);
+
+private:
+    FbTextIndex m_index;
+    QSet<int> m_roots;
+    int m_serial;
+};
+
+class FbStatWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FbStatWidget(FbTextEdit *text, QWidget *parent = 0);
+    QSize sizeHint() const { return QSize(200,200); }
+
+private slots:
+    void refresh();
+
+private:
+    FbTextEdit *m_text;
+    QTreeWidget *m_tree;
+    QLabel *m_label;
+};
+
+#endif // FB2STAT_H
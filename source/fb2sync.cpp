@@ -0,0 +1,454 @@
+#include "fb2sync.hpp"
+
+#include <QHash>
+#include <QRegularExpression>
+#include <QSet>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QWebFrame>
+#include <QXmlStreamReader>
+#include <QtDebug>
+
+#include "fb2code.hpp"
+#include "fb2html.h"
+#include "fb2imgs.hpp"
+#include "fb2page.hpp"
+#include "fb2read.hpp"
+#include "fb2save.hpp"
+#include "fb2text.hpp"
+
+//---------------------------------------------------------------------------
+//  FbSyncMap
+//---------------------------------------------------------------------------
+
+FbSyncMap::FbSyncMap(FbTextEdit *text, FbCodeEdit *code, QObject *parent)
+    : QObject(parent)
+    , m_text(text)
+    , m_code(code)
+    , m_undo(0)
+    , m_valid(false)
+    , m_outside(false)
+    , m_updating(false)
+{
+    connect(m_code->document(), SIGNAL(contentsChange(int,int,int)), SLOT(contentsChange(int,int,int)));
+    connect(m_text->page(), SIGNAL(loadFinished(bool)), SLOT(loadFinished()));
+    connect(m_code, SIGNAL(expandBinary(int)), SLOT(expandBinary(int)));
+}
+
+void FbSyncMap::textToCode()
+{
+    if (!updateCode()) writeCode();
+}
+
+bool FbSyncMap::codeToText()
+{
+    if (updateText()) return true;
+    QString xml = m_code->toPlainText();
+    QString full;
+    if (!unfold(xml, full)) return false;
+    m_valid = false;
+    m_pending = scan(xml);
+    m_text->page()->read(full);
+    return true;
+}
+
+QRegularExpression FbSyncMap::folded()
+{
+    // Binaries are written by FbSaveWriter::writeFiles as a single line
+    // placeholder, their data stays in the store until it is needed.
+    // Line breaks the user may have put around the comment are allowed.
+    return QRegularExpression("<binary\\b([^>]*)>\\s*<!-- (\\d+) bytes -->\\s*</binary>");
+}
+
+bool FbSyncMap::binary(const QRegularExpressionMatch &match, QString &result) const
+{
+    QString atts = match.captured(1);
+    QString name = QRegularExpression("\\bid=\"([^\"]*)\"").match(atts).captured(1);
+    FbStore *store = m_text->store();
+    FbBinary *file = store ? store->get(name) : 0;
+    if (!file) {
+        qCritical() << tr("Binary not found: %1").arg(name);
+        return false;
+    }
+
+    QString data = file->data().toBase64();
+    result = "<binary" + atts + ">\n";
+    for (int pos = 0; pos < data.length(); pos += 76) {
+        result += data.midRef(pos, 76);
+        result += '\n';
+    }
+    result += "  </binary>";
+    return true;
+}
+
+bool FbSyncMap::unfold(const QString &xml, QString &result) const
+{
+    // A placeholder without its binary in the store stops the whole
+    // text, the cursor is left on it for the user to fix the id.
+    result = xml;
+    if (!xml.contains(" bytes -->")) return true;
+
+    result.clear();
+    int last = 0;
+    QRegularExpressionMatchIterator it = folded().globalMatch(xml);
+    while (it.hasNext()) {
+        QRegularExpressionMatch match = it.next();
+        QString data;
+        if (!binary(match, data)) {
+            result.clear();
+            m_code->setPosition(match.capturedStart());
+            return false;
+        }
+        result += xml.midRef(last, match.capturedStart() - last);
+        result += data;
+        last = match.capturedEnd();
+    }
+    result += xml.midRef(last);
+    return true;
+}
+
+void FbSyncMap::expandBinary(int position)
+{
+    // The placeholder may be split over the block and the one before,
+    // a block separator counts as one character like the line break.
+    QTextBlock block = m_code->document()->findBlock(position);
+    QTextBlock first = block;
+    QString text = block.text();
+    if (!text.contains("<binary") && block.previous().isValid()) {
+        first = block.previous();
+        text = first.text() + '\n' + text;
+    }
+    QRegularExpressionMatch match = folded().match(text);
+    if (!match.hasMatch()) return;
+
+    QTextCursor cursor(first);
+    cursor.setPosition(first.position() + match.capturedStart());
+    cursor.setPosition(first.position() + match.capturedEnd(), QTextCursor::KeepAnchor);
+    QString data;
+    if (!binary(match, data)) return;
+    cursor.insertText(data);
+}
+
+QList<FbSyncMap::Section> FbSyncMap::scan(const QString &xml)
+{
+    // Top-level sections of every body, a range starts right after
+    // the markup preceding the section, as FbSaveWriter records it.
+    QList<Section> result;
+    QXmlStreamReader reader(xml);
+    Section section;
+    int depth = 0;
+    int last = 0;
+    bool inside = false;
+    while (!reader.atEnd()) {
+        switch (reader.readNext()) {
+            case QXmlStreamReader::StartElement:
+                depth++;
+                if (depth == 3 && reader.name() == "section") {
+                    section.id = 0;
+                    section.start = last;
+                    section.dirty = false;
+                    section.names.clear();
+                    inside = true;
+                } else if (inside && reader.name() == "image") {
+                    foreach (const QXmlStreamAttribute &attr, reader.attributes()) {
+                        QString href = attr.value().toString();
+                        if (attr.name() == "href" && href.left(1) == "#") section.names << href.mid(1);
+                    }
+                }
+                break;
+            case QXmlStreamReader::EndElement:
+                if (depth == 3 && inside) {
+                    section.end = reader.characterOffset();
+                    result.append(section);
+                    inside = false;
+                }
+                depth--;
+                break;
+            case QXmlStreamReader::Characters:
+                if (reader.isWhitespace()) continue;
+                break;
+            default: ;
+        }
+        last = reader.characterOffset();
+    }
+    if (reader.hasError()) result.clear();
+    return result;
+}
+
+QVariantList FbSyncMap::changes()
+{
+    return m_text->page()->mainFrame()->evaluateJavaScript("FbVirtual.changes()").toList();
+}
+
+void FbSyncMap::loadFinished()
+{
+    // Sections found in the code text get their ids once the
+    // page built from it is there; any other load drops the map.
+    QList<Section> list = m_pending;
+    m_pending.clear();
+    m_valid = false;
+    if (list.isEmpty()) return;
+
+    QVariantList ids = m_text->page()->mainFrame()->evaluateJavaScript("FbSectionIds()").toList();
+    if (ids.count() != list.count()) return;
+    for (int i = 0; i < list.count(); i++) list[i].id = ids.at(i).toInt();
+
+    changes();
+    setSections(list);
+    m_undo = m_text->page()->undoStack()->index();
+    m_outside = false;
+    m_valid = true;
+}
+
+void FbSyncMap::contentsChange(int position, int removed, int added)
+{
+    if (m_updating || !m_valid || m_outside) return;
+
+    int end = position + removed;
+    int delta = added - removed;
+    bool found = false;
+    for (int i = 0; i < m_sections.count(); i++) {
+        Section &section = m_sections[i];
+        if (section.end <= position) continue;
+        if (section.start >= end) {
+            section.start += delta;
+            section.end += delta;
+        } else if (section.start < position && end < section.end) {
+            section.end += delta;
+            section.dirty = true;
+            found = true;
+        } else {
+            m_outside = true;
+            return;
+        }
+    }
+    if (!found) m_outside = true;
+}
+
+void FbSyncMap::writeCode()
+{
+    QString xml;
+    FbSaveWriter writer(*m_text, &xml);
+    writer.setElided(true);
+    FbSaveHandler(writer).save();
+    changes();
+
+    m_updating = true;
+    m_code->setPlainText(xml);
+    m_updating = false;
+
+    QList<Section> sections;
+    foreach (const FbSaveSection &item, writer.sections()) {
+        Section section;
+        section.id = item.id;
+        section.start = item.start;
+        section.end = item.end;
+        section.dirty = false;
+        section.names = item.names;
+        sections.append(section);
+    }
+    setSections(sections);
+    m_undo = m_text->page()->undoStack()->index();
+    m_outside = false;
+    m_valid = true;
+
+    setCursor(writer.anchor(), writer.focus());
+}
+
+bool FbSyncMap::updateCode()
+{
+    if (!m_valid || m_outside) return false;
+    foreach (const Section &section, m_sections) {
+        if (section.dirty) return false;
+    }
+
+    QSet<int> changed;
+    foreach (const QVariant &value, changes()) {
+        int id = value.toInt();
+        if (id < 0) return false;
+        changed.insert(id);
+    }
+    int undo = m_text->page()->undoStack()->index();
+    if (changed.isEmpty() && undo == m_undo) return true;
+
+    QHash<int, int> index;
+    FbSkipHash skip;
+    for (int i = 0; i < m_sections.count(); i++) {
+        const Section &section = m_sections.at(i);
+        if (section.id <= 0 || changed.contains(section.id)) continue;
+        index.insert(section.id, i);
+        skip.insert(section.id, section.names);
+    }
+
+    QString text;
+    FbSaveWriter writer(*m_text, &text);
+    writer.setElided(true);
+    writer.setSkipped(skip);
+    FbSaveHandler(writer).save();
+    changes();
+
+    // Clean sections keep their text, the code between them is
+    // replaced where it differs from the newly written one.
+    const FbSaveSections &list = writer.sections();
+    QList<int> clean;
+    QList<int> holes;
+    foreach (const FbSaveSection &item, list) {
+        if (!item.skipped) continue;
+        int i = index.value(item.id, -1);
+        if (i < 0 || (!clean.isEmpty() && i <= clean.last())) return false;
+        clean.append(i);
+        holes.append(item.start);
+    }
+
+    QString code = m_code->toPlainText();
+    QTextCursor cursor(m_code->document());
+    m_updating = true;
+    cursor.beginEditBlock();
+    for (int k = clean.count(); k >= 0; k--) {
+        int oldFrom = k ? m_sections.at(clean.at(k - 1)).end : 0;
+        int oldTo = k < clean.count() ? m_sections.at(clean.at(k)).start : code.length();
+        int newFrom = k ? holes.at(k - 1) : 0;
+        int newTo = k < clean.count() ? holes.at(k) : text.length();
+        QStringRef before = code.midRef(oldFrom, oldTo - oldFrom);
+        QStringRef after = text.midRef(newFrom, newTo - newFrom);
+        if (before == after) continue;
+        int size = qMin(before.length(), after.length());
+        int head = 0;
+        while (head < size && before.at(head) == after.at(head)) head++;
+        int tail = 0;
+        while (tail < size - head && before.at(before.length() - tail - 1) == after.at(after.length() - tail - 1)) tail++;
+        cursor.setPosition(oldFrom + head);
+        cursor.setPosition(oldTo - tail, QTextCursor::KeepAnchor);
+        cursor.insertText(text.mid(newFrom + head, after.length() - head - tail));
+    }
+    cursor.endEditBlock();
+    m_updating = false;
+
+    QList<Section> sections;
+    QList<int> offsets;
+    QList<int> deltas;
+    int delta = 0;
+    foreach (const FbSaveSection &item, list) {
+        Section section;
+        if (item.skipped) {
+            section = m_sections.at(index.value(item.id));
+            int size = section.end - section.start;
+            section.start = item.start + delta;
+            section.end = section.start + size;
+            delta += size;
+            offsets.append(item.start);
+            deltas.append(delta);
+        } else {
+            section.id = item.id;
+            section.start = item.start + delta;
+            section.end = item.end + delta;
+            section.dirty = false;
+            section.names = item.names;
+        }
+        sections.append(section);
+    }
+    setSections(sections);
+    m_undo = undo;
+
+    if (m_code->document()->characterCount() - 1 != text.length() + delta) {
+        qCritical() << "Code view is out of sync, writing it again";
+        writeCode();
+        return true;
+    }
+
+    int anchor = writer.anchor();
+    int focus = writer.focus();
+    for (int i = offsets.count() - 1; i >= 0; i--) {
+        if (offsets.at(i) < anchor) { anchor += deltas.at(i); break; }
+    }
+    for (int i = offsets.count() - 1; i >= 0; i--) {
+        if (offsets.at(i) < focus) { focus += deltas.at(i); break; }
+    }
+    setCursor(anchor, focus);
+    return true;
+}
+
+bool FbSyncMap::updateText()
+{
+    if (!m_valid || m_outside) return false;
+
+    QList<int> dirty;
+    for (int i = 0; i < m_sections.count(); i++) {
+        if (m_sections.at(i).dirty) dirty.append(i);
+    }
+    if (dirty.isEmpty()) return true;
+
+    QString code = m_code->toPlainText();
+    int first = m_sections.first().start;
+    QRegularExpressionMatch match = QRegularExpression("<FictionBook\\b[^>]*>").match(code.left(first));
+    if (!match.hasMatch()) return false;
+    QString root = match.captured();
+
+    // Every changed section is parsed before the page is touched,
+    // a broken one leaves the work and its errors to the full read.
+    FbTextPage *page = m_text->page();
+    FbStore *store = m_text->store();
+    int nodes = store->nodes();
+    QList<FbTextElement> elements;
+    QStringList html;
+    foreach (int i, dirty) {
+        const Section &section = m_sections.at(i);
+        FbTextElement element = page->doc().findFirst(QString("fb\\:section[data-node='%1']").arg(section.id));
+        if (element.isNull()) return false;
+        QString name = element.parent().attribute("name");
+        QString body = name.isEmpty() ? QString("<body>") : QString("<body name=\"%1\">").arg(name.toHtmlEscaped());
+        QString xml = root + body + code.mid(section.start, section.end - section.start) + "</body></FictionBook>";
+        QString text = FbReadHandler::section(xml, nodes);
+        if (text.isEmpty()) return false;
+        elements.append(element);
+        html.append(text);
+    }
+
+    store->setNodes(nodes);
+    QRegularExpression rx("data-node=\"(\\d+)\"");
+    for (int k = 0; k < dirty.count(); k++) {
+        Section &section = m_sections[dirty.at(k)];
+        elements[k].setOuterXml(html.at(k));
+        section.id = rx.match(html.at(k)).captured(1).toInt();
+        section.dirty = false;
+        section.names = scan(root + "<body>" + code.mid(section.start, section.end - section.start) + "</body></FictionBook>").value(0).names;
+    }
+
+    page->undoStack()->clear();
+    page->notify(page->body());
+    changes();
+    m_undo = page->undoStack()->index();
+    return true;
+}
+
+void FbSyncMap::setSections(const QList<Section> &list)
+{
+    m_sections = list;
+    m_ids.clear();
+    for (int i = 0; i < m_sections.count(); i++) {
+        m_ids.insert(m_sections.at(i).id, i);
+    }
+}
+
+int FbSyncMap::position(int id) const
+{
+    // Offset of the section tag in the code view, -1 when unknown;
+    // ranges follow the edits, so the lookup needs no text scan.
+    if (!m_valid) return -1;
+    int index = m_ids.value(id, -1);
+    if (index < 0) return -1;
+    QTextDocument *doc = m_code->document();
+    int pos = m_sections.at(index).start;
+    int end = m_sections.at(index).end;
+    while (pos < end && doc->characterAt(pos).isSpace()) pos++;
+    return pos;
+}
+
+void FbSyncMap::setCursor(int anchor, int focus)
+{
+    QTextCursor cursor = m_code->textCursor();
+    if (anchor > 0) cursor.setPosition(anchor, QTextCursor::MoveAnchor);
+    if (focus > 0) cursor.setPosition(focus, QTextCursor::KeepAnchor);
+    m_code->setTextCursor(cursor);
+}
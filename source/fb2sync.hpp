@@ -0,0 +1,63 @@
+#ifndef FB2SYNC_H
+#define FB2SYNC_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QVariant>
+
+class FbCodeEdit;
+class FbTextEdit;
+
+class FbSyncMap : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FbSyncMap(FbTextEdit *text, FbCodeEdit *code, QObject *parent = 0);
+    void textToCode();
+    bool codeToText();
+    bool unfold(const QString &xml, QString &result) const;
+    int position(int id) const;
+
+private slots:
+    void contentsChange(int position, int removed, int added);
+    void loadFinished();
+    void expandBinary(int position);
+
+private:
+    class Section
+    {
+    public:
+        int id;
+        int start;
+        int end;
+        bool dirty;
+        QStringList names;
+    };
+
+    static QList<Section> scan(const QString &xml);
+    static QRegularExpression folded();
+    bool binary(const QRegularExpressionMatch &match, QString &result) const;
+    QVariantList changes();
+    bool updateCode();
+    bool updateText();
+    void writeCode();
+    void setCursor(int anchor, int focus);
+    void setSections(const QList<Section> &list);
+
+private:
+    FbTextEdit *m_text;
+    FbCodeEdit *m_code;
+    QList<Section> m_sections;
+    QList<Section> m_pending;
+    QHash<int, int> m_ids;
+    int m_undo;
+    bool m_valid;
+    bool m_outside;
+    bool m_updating;
+};
+
+#endif // FB2SYNC_H
@@ -1,11 +1,13 @@
 #include "fb2text.hpp"
 
 #include <QVBoxLayout>
+#include <QApplication>
 #include <QDockWidget>
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QMainWindow>
 #include <QMenu>
+#include <QProgressDialog>
 #include <QToolBar>
 #include <QWebInspector>
 #include <QWebFrame>
@@ -16,6 +18,8 @@
 #include "fb2note.hpp"
 #include "fb2page.hpp"
 #include "fb2save.hpp"
+#include "fb2srch.hpp"
+#include "fb2stat.hpp"
 #include "fb2tree.hpp"
 #include "fb2utils.h"
 
@@ -42,11 +46,18 @@ QAction * FbTextAction::action()
     return m_parent->pageAction(m_action);
 }
 
+bool FbTextAction::actionEnabled(QAction *act)
+{
+    // Undo is kept disabled at the floor of a trimmed history
+    if (m_action == QWebPage::Undo && !m_parent->page()->canUndo()) return false;
+    return act->isEnabled();
+}
+
 void FbTextAction::updateAction()
 {
     if (QAction * act = action()) {
         if (isCheckable()) setChecked(act->isChecked());
-        setEnabled(act->isEnabled());
+        setEnabled(actionEnabled(act));
     }
 }
 
@@ -56,7 +67,7 @@ void FbTextAction::connectAction()
         connect(this, SIGNAL(triggered(bool)), act, SIGNAL(triggered(bool)));
         connect(act, SIGNAL(changed()), this, SLOT(updateAction()));
         if (isCheckable()) setChecked(act->isChecked());
-        setEnabled(act->isEnabled());
+        setEnabled(actionEnabled(act));
     } else {
         if (isCheckable()) setChecked(false);
         setEnabled(false);
@@ -118,6 +129,7 @@ void FbNoteView::hint(const QWebElement element, const QRect &rect)
         "<fb:body name=notes style='padding:0;margin:0;'>"
     );
     html.append("</fb:body></body>");
+    html.replace(" data-src=", " src=");
     setGeometry(rect);
     setHtml(html, m_url);
     show();
@@ -215,13 +227,16 @@ FbTextEdit::FbTextEdit(QWidget *parent, QObject *owner)
     , dockTree(0)
     , dockNote(0)
     , dockImgs(0)
+    , dockStat(0)
     , dockInsp(0)
+    , dockFind(0)
 {
     FbTextPage * p = new FbTextPage(this);
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, SIGNAL(customContextMenuRequested(QPoint)), SLOT(contextMenu(QPoint)));
     connect(p, SIGNAL(linkHovered(QString,QString,QString)), SLOT(linkHovered(QString,QString,QString)));
     connect(p->undoStack(), SIGNAL(cleanChanged(bool)), SLOT(cleanChanged(bool)));
+    connect(p, SIGNAL(historyChanged()), SLOT(updateHistory()));
     setPage(p);
 }
 
@@ -266,6 +281,8 @@ void FbTextEdit::connectActions(QToolBar *tool)
     }
 
     connect(act(Fb::EditFind), SIGNAL(triggered()), SLOT(find()));
+    connect(act(Fb::EditReplace), SIGNAL(triggered()), SLOT(replace()));
+    connect(act(Fb::OptimizeImages), SIGNAL(triggered()), SLOT(optimizeImages()));
 
     connect(act(Fb::InsertImage), SIGNAL(triggered()), SLOT(insertImage()));
     connect(act(Fb::InsertLink), SIGNAL(triggered()), SLOT(insertLink()));
@@ -274,6 +291,7 @@ void FbTextEdit::connectActions(QToolBar *tool)
     connect(act(Fb::ViewContents), SIGNAL(triggered(bool)), SLOT(viewContents(bool)));
     connect(act(Fb::ViewPictures), SIGNAL(triggered(bool)), SLOT(viewPictures(bool)));
     connect(act(Fb::ViewFootnotes), SIGNAL(triggered(bool)), SLOT(viewFootnotes(bool)));
+    connect(act(Fb::ViewStatistics), SIGNAL(triggered(bool)), SLOT(viewStatistics(bool)));
     connect(act(Fb::ViewInspector), SIGNAL(triggered(bool)), SLOT(viewInspector(bool)));
 
     connect(act(Fb::ZoomIn), SIGNAL(triggered()), SLOT(zoomIn()));
@@ -337,7 +355,12 @@ void FbTextEdit::disconnectActions()
     }
     viewContents(false);
     viewPictures(false);
+    viewStatistics(false);
     viewInspector(false);
+    if (dockFind) {
+        dockFind->deleteLater();
+        dockFind = 0;
+    }
 }
 
 #ifdef QT_DEBUG
@@ -417,6 +440,21 @@ void FbTextEdit::viewFootnotes(bool show)
     }
 }
 
+void FbTextEdit::viewStatistics(bool show)
+{
+    if (show) {
+        if (dockStat) { dockStat->show(); return; }
+        dockStat = new FbDockWidget(tr("Statistics"), this);
+        dockStat->setWidget(new FbStatWidget(this, m_owner));
+        connect(dockStat, SIGNAL(visibilityChanged(bool)), act(Fb::ViewStatistics), SLOT(setChecked(bool)));
+        connect(dockStat, SIGNAL(destroyed()), SLOT(statDestroyed()));
+        m_owner->addDockWidget(Qt::RightDockWidgetArea, dockStat);
+    } else if (dockStat) {
+        dockStat->deleteLater();
+        dockStat = 0;
+    }
+}
+
 void FbTextEdit::viewInspector(bool show)
 {
     if (show) {
@@ -467,6 +505,17 @@ void FbTextEdit::noteDestroyed()
     dockNote = 0;
 }
 
+void FbTextEdit::statDestroyed()
+{
+    m_actions[Fb::ViewStatistics]->setChecked(false);
+    dockStat = 0;
+}
+
+void FbTextEdit::findDestroyed()
+{
+    dockFind = 0;
+}
+
 FbNoteView & FbTextEdit::noteView()
 {
     if (m_noteView) return *m_noteView;
@@ -494,11 +543,34 @@ void FbTextEdit::mouseMoveEvent(QMouseEvent *event)
     QWebView::mouseMoveEvent(event);
 }
 
+void FbTextEdit::keyPressEvent(QKeyEvent *event)
+{
+    // WebKit undoes typed shortcuts by itself, past the history floor
+    if (event->matches(QKeySequence::Undo)) {
+        page()->triggerAction(QWebPage::Undo);
+        return;
+    }
+    FbTextBase::keyPressEvent(event);
+}
+
 void FbTextEdit::cleanChanged(bool clean)
 {
     emit modificationChanged(!clean);
 }
 
+void FbTextEdit::updateHistory()
+{
+    QAction *action = act(Fb::EditUndo);
+    if (!action) return;
+    FbTextPage *page = this->page();
+    FbTextAction *undo = qobject_cast<FbTextAction*>(action);
+    if (undo && isVisible()) undo->updateAction();
+    QString text = tr("Undo history: %1 KB of %2 KB");
+    text = text.arg(page->historyMemory() >> 10).arg(page->historyLimit() >> 10);
+    action->setToolTip(text);
+    action->setStatusTip(text);
+}
+
 void FbTextEdit::contextMenu(const QPoint &pos)
 {
     QMenu menu, *submenu;
@@ -578,6 +650,7 @@ bool FbTextEdit::save(QString *string, int &anchor, int &focus)
 
 QString FbTextEdit::toHtml()
 {
+    page()->expandFragments();
     return page()->mainFrame()->toHtml();
 }
 
@@ -635,10 +708,87 @@ bool FbTextEdit::SupChecked()
     return pageAction(QWebPage::ToggleSuperscript)->isChecked();
 }
 
+FbSearchWidget & FbTextEdit::searchWidget()
+{
+    if (!dockFind) {
+        dockFind = new FbDockWidget(tr("Find"), this);
+        dockFind->setWidget(new FbSearchWidget(this, m_owner));
+        connect(dockFind, SIGNAL(destroyed()), SLOT(findDestroyed()));
+        m_owner->addDockWidget(Qt::RightDockWidgetArea, dockFind);
+    }
+    dockFind->show();
+    dockFind->raise();
+    return *qobject_cast<FbSearchWidget*>(dockFind->widget());
+}
+
 void FbTextEdit::find()
 {
-    FbTextFindDlg dlg(*this);
-    dlg.exec();
+    searchWidget().activate();
+}
+
+void FbTextEdit::replace()
+{
+    searchWidget().activate(true);
+}
+
+void FbTextEdit::optimizeImages()
+{
+    if (m_optimizer) {
+        if (m_progress) m_progress->activateWindow();
+        return;
+    }
+
+    FbOptimizeDlg dlg(this);
+    if (!dlg.exec()) return;
+
+    m_optimizer = FbImageThread::execute(this, store(), dlg.options());
+    m_progress = new QProgressDialog(tr("Optimize images..."), tr("Cancel"), 0, 0, this);
+    m_progress->setAttribute(Qt::WA_DeleteOnClose);
+    m_progress->setMinimumDuration(500);
+    connect(m_progress, SIGNAL(canceled()), m_optimizer, SLOT(cancel()));
+    connect(m_optimizer, SIGNAL(finished()), m_progress, SLOT(close()));
+}
+
+void FbTextEdit::optimizing(int done, int total)
+{
+    if (!m_progress) return;
+    m_progress->setMaximum(total);
+    m_progress->setValue(done);
+}
+
+void FbTextEdit::optimized(const QVariantList &list)
+{
+    FbImageThread *thread = qobject_cast<FbImageThread*>(sender());
+    if (!thread) return;
+
+    // The book may have been reloaded while the pictures were encoded.
+    FbStore *store = this->store();
+    if (thread->store() != store) return;
+
+    qint64 before = 0;
+    qint64 after = 0;
+    FbBinaryMap result;
+    for (int i = 0; i + 1 < list.count(); i += 2) {
+        QString name = list.at(i).toString();
+        FbBinary *binary = store->get(name);
+        if (!binary) continue;
+        QByteArray data = list.at(i + 1).toByteArray();
+        qint64 size = binary->size();
+        qint64 done = data.size();
+        before += size;
+        after += done;
+        result.insert(name, data);
+        QString line = tr("%1: %2 -> %3 bytes (-%4%)").arg(name).arg(size).arg(done).arg(100 - done * 100 / size);
+        qDebug("%s", qPrintable(line));
+    }
+
+    const FbImageOptions &options = thread->options();
+    QString total = tr("Optimize images: %1 of %2 pictures smaller, %3 bytes saved").arg(result.count()).arg(store->count()).arg(before - after);
+    if (options.dryrun) total += tr(" (dry run)");
+    qDebug("%s", qPrintable(total));
+
+    if (options.dryrun || result.isEmpty()) return;
+    page()->push(new FbImageCmd(store, result), tr("Optimize images"));
 }
 
 void FbTextEdit::insertImage()
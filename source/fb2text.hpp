@@ -4,6 +4,7 @@
 #include <QAction>
 #include <QDockWidget>
 #include <QFrame>
+#include <QPointer>
 #include <QResizeEvent>
 #include <QTimer>
 #include <QWebElement>
@@ -14,11 +15,13 @@
 
 QT_BEGIN_NAMESPACE
 class QMainWindow;
+class QProgressDialog;
 class QToolBar;
 QT_END_NAMESPACE
 
 class FbNoteView;
 class FbReadThread;
+class FbSearchWidget;
 class FbTextPage;
 
 class FbDockWidget : public QDockWidget
@@ -99,19 +102,24 @@ public:
 
 signals:
     void modificationChanged(bool changed);
+    void showNode(int id);
 
 protected:
     virtual void mouseMoveEvent(QMouseEvent *event);
+    virtual void keyPressEvent(QKeyEvent *event);
 
 public slots:
     void viewContents(bool show);
     void viewPictures(bool show);
     void viewFootnotes(bool show);
+    void viewStatistics(bool show);
     void viewInspector(bool show);
     void insertImage();
     void insertNote();
     void insertLink();
     void find();
+    void replace();
+    void optimizeImages();
 
 #ifdef QT_DEBUG
 public slots:
@@ -122,9 +130,14 @@ private slots:
     void linkHovered(const QString &link, const QString &title, const QString &textContent);
     void contextMenu(const QPoint &pos);
     void cleanChanged(bool clean);
+    void updateHistory();
+    void optimizing(int done, int total);
+    void optimized(const QVariantList &result);
     void treeDestroyed();
     void imgsDestroyed();
     void noteDestroyed();
+    void statDestroyed();
+    void findDestroyed();
     void zoomIn();
     void zoomOut();
     void zoomReset();
@@ -135,16 +148,21 @@ private:
     void execCommand(const QString &cmd, const QString &arg);
     FbBinary * file(const QString &name);
     FbNoteView & noteView();
+    FbSearchWidget & searchWidget();
 
 private:
     QMainWindow *m_owner;
     FbNoteView *m_noteView;
     FbReadThread *m_thread;
+    QPointer<FbImageThread> m_optimizer;
+    QPointer<QProgressDialog> m_progress;
     FbActionMap m_actions;
     QDockWidget *dockTree;
     QDockWidget *dockNote;
     QDockWidget *dockImgs;
+    QDockWidget *dockStat;
     QDockWidget *dockInsp;
+    QDockWidget *dockFind;
     QPoint m_point;
 };
 
@@ -165,11 +183,12 @@ public:
     void connectAction();
     void disconnectAction();
 
-private slots:
+public slots:
     void updateAction();
 
 private:
     QAction * action();
+    bool actionEnabled(QAction *act);
 
 private:
     QWebPage::WebAction m_action;
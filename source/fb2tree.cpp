@@ -41,22 +41,24 @@ void FbTreeItem::init()
     m_name = m_element.tagName().toLower();
     if (m_name.left(3) == "fb:") m_name = m_name.mid(3);
     if (m_name == "title") {
-        m_text = title();
-        if (m_parent) m_parent->m_text += m_text += " ";
+        m_text = title(m_element) + " ";
     } else if (m_name == "subtitle") {
-        m_text = title();
-    } else if (m_name == "body") {
-        m_body = m_element.attribute("name");
+        m_text = title(m_element);
+    } else if (m_name == "body" || m_name == "section") {
+        if (m_name == "body") m_body = m_element.attribute("name");
+        FbTextElement child = m_element.firstChild();
+        while (child.tagName() == "IMG") child = child.nextSibling();
+        if (child.isTitle()) m_text = title(child) + " ";
     } else if (m_name == "img") {
         m_name = "image";
-        QUrl url = m_element.attribute("src");
+        QUrl url = m_element.attribute("src", m_element.attribute("data-src"));
         m_text = url.fragment();
     }
 }
 
-QString FbTreeItem::title()
+QString FbTreeItem::title(const QWebElement &element)
 {
-    return m_element.toPlainText().left(255).simplified();
+    return element.toPlainText().left(255).simplified();
 }
 
 FbTreeItem * FbTreeItem::item(const QModelIndex &index) const
@@ -79,38 +81,9 @@ QString FbTreeItem::text() const
     return QString("<%1> %2").arg(name).arg(m_text);
 }
 
-QString FbTreeItem::selector() const
-{
-    QString text = "";
-    QString selector = ".get(0)";
-    QWebElement element = m_element;
-    QWebElement parent = element.parent();
-    while (!parent.isNull()) {
-        text.prepend(element.tagName()).prepend("/");
-        QWebElement child = parent.firstChild();
-        int index = -1;
-        while (!child.isNull()) {
-            index++;
-            if (child == element) break;
-            child = child.nextSibling();
-        }
-        if (index == -1) return QString();
-        selector.prepend(QString(".children().eq(%1)").arg(index));
-        element = parent;
-        parent = element.parent();
-    }
-    return selector.prepend("$('html')");
-}
-
-FbTreeItem * FbTreeItem::content(int number) const
+int FbTreeItem::id() const
 {
-    FbTextElement element = m_element.firstChild();
-    while (number-- > 0) element = element.nextSibling();
-    FbTreeList::const_iterator it;
-    for (it = m_list.constBegin(); it != m_list.constEnd(); it++) {
-        if ((*it)->element() == element) return *it;
-    }
-    return 0;
+    return m_element.attribute("data-node").toInt();
 }
 
 //---------------------------------------------------------------------------
@@ -199,26 +172,42 @@ QVariant FbTreeModel::data(const QModelIndex &index, int role) const
 
 void FbTreeModel::selectText(const QModelIndex &index)
 {
+    // A folded section is expanded first, the tree is rebuilt with
+    // its subsections once the page reports the change.
     if (FbTreeItem *node = item(index)) {
-        node->element().select();
+        FbTextElement element = node->element();
+        for (QWebElement child = element.firstChild(); !child.isNull(); child = child.nextSibling()) {
+            if (!child.hasAttribute("data-fragment")) continue;
+            QString javascript = QString("FbVirtual.expand(%1)").arg(child.attribute("data-fragment"));
+            m_view.page()->mainFrame()->evaluateJavaScript(javascript);
+            break;
+        }
+        element.select();
     }
 }
 
-QModelIndex FbTreeModel::index(const QString &location) const
+FbTreeItem * FbTreeModel::item(int id) const
 {
-    QModelIndex result;
-    FbTreeItem * parent = m_root;
-    QStringList list = location.split(",");
-    QStringListIterator iterator(list);
-    while (parent && iterator.hasNext()) {
-        QString str = iterator.next();
-        if (str.left(5) == "HTML=") continue;
-        int key = str.mid(str.indexOf("=")+1).toInt();
-        FbTreeItem * child = parent->content(key);
-        if (child) result = index(child);
-        parent = child;
+    if (!id) return NULL;
+    return m_ids.value(id);
+}
+
+void FbTreeModel::attach(FbTreeItem &item)
+{
+    if (&item == m_root) return;
+
+    // Clones and new elements get a fresh id, the one of
+    // the element still referenced from the tree is kept
+    FbTextElement element = item.element();
+    int id = item.id();
+    FbTreeItem * other = this->item(id);
+    if (!id || (other && other != &item && other->element() != element)) {
+        FbStore * store = m_view.store();
+        if (!store) return;
+        id = store->newNode();
+        element.setAttribute("data-node", QString::number(id));
     }
-    return result;
+    m_ids[id] = &item;
 }
 
 QModelIndex FbTreeModel::move(const QModelIndex &index, int dx, int dy)
@@ -306,21 +295,26 @@ bool FbTreeModel::removeRows(int row, int count, const QModelIndex &parent)
     FbTreeItem * owner = item(parent);
     if (!owner) return false;
     int last = row + count - 1;
+    FbElementList list;
     beginRemoveRows(parent, row, last);
     for (int i = last; i >= row; i--) {
         if (FbTreeItem * child = owner->takeAt(i)) {
-            QUndoCommand * command = new FbDeleteCmd(child->element());
-            m_view.page()->push(command, "Delete element");
+            list << child->element();
             delete child;
         }
     }
     endRemoveRows();
+    foreach (FbTextElement element, list) {
+        QUndoCommand * command = new FbDeleteCmd(element);
+        m_view.page()->push(command, "Delete element");
+    }
     return true;
 }
 
-void FbTreeModel::update(FbTreeItem &owner)
+void FbTreeModel::update(FbTreeItem &owner, bool deep)
 {
     owner.init();
+    attach(owner);
     FbElementList list;
     owner.element().getChildren(list);
 
@@ -343,7 +337,7 @@ void FbTreeModel::update(FbTreeItem &owner)
         }
         if (child) {
             QString old = child->text();
-            update(*child);
+            if (deep) update(*child); else { child->init(); attach(*child); }
             if (old != child->text()) {
                 QModelIndex i = this->index(child);
                 emit dataChanged(i, i);
@@ -381,12 +375,69 @@ void FbTreeModel::update()
     }
 }
 
+FbTreeItem * FbTreeModel::find(const QWebElement &element) const
+{
+    if (!m_root) return NULL;
+
+    for (QWebElement node = element; !node.isNull(); node = node.parent()) {
+        if (!node.hasAttribute("data-node")) continue;
+        FbTreeItem * result = item(node.attribute("data-node").toInt());
+        if (result && result->element() == node) return result;
+        break;
+    }
+
+    FbElementList list;
+    QWebElement node = element;
+    while (node != m_root->element()) {
+        if (node.isNull()) return NULL;
+        list.prepend(node);
+        node = node.parent();
+    }
+
+    // Elements without items, like paragraphs, are passed through
+    FbTreeItem * result = m_root;
+    foreach (const FbTextElement &step, list) {
+        int count = result->count();
+        for (int i = 0; i < count; i++) {
+            FbTreeItem * child = result->item(i);
+            if (child->element() == step) {
+                result = child;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+void FbTreeModel::update(const QWebElement &element)
+{
+    FbTreeItem * owner = find(element);
+    if (!owner) return;
+
+    update(*owner, false);
+    while (FbTreeItem * parent = owner->parent()) {
+        QString old = parent->text();
+        parent->init();
+        if (old != parent->text()) {
+            QModelIndex i = index(parent);
+            emit dataChanged(i, i);
+        }
+        owner = parent;
+    }
+}
+
 QModelIndex FbTreeModel::append(const QModelIndex &parent, FbTextElement element)
 {
     FbTreeItem * owner = item(parent);
     if (!owner || owner == m_root) return QModelIndex();
 
+    // The insert command may have already added the item
     int count = owner->count();
+    for (int i = 0; i < count; i++) {
+        FbTreeItem * child = owner->item(i);
+        if (child->element() == element) return createIndex(i, 0, (void*)child);
+    }
+
     int row = element.childIndex();
     if (row > count) row = count;
     if (row < 0) row = 0;
@@ -395,6 +446,7 @@ QModelIndex FbTreeModel::append(const QModelIndex &parent, FbTextElement element
     beginInsertRows(parent, row, row);
     owner->insert(child, row);
     endInsertRows();
+    attach(*child);
 
     return createIndex(row, 0, (void*)child);
 }
@@ -406,6 +458,7 @@ QModelIndex FbTreeModel::append(const QModelIndex &parent, FbTextElement element
 FbTreeView::FbTreeView(FbTextEdit &view, QWidget *parent)
     : QTreeView(parent)
     , m_view(view)
+    , m_siblings(0)
 {
     setHeaderHidden(true);
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -422,7 +475,7 @@ FbTreeView::FbTreeView(FbTextEdit &view, QWidget *parent)
 
     m_timerUpdate.setInterval(1000);
     m_timerUpdate.setSingleShot(true);
-    connect(&m_timerUpdate, SIGNAL(timeout()), SLOT(updateTree()));
+    connect(&m_timerUpdate, SIGNAL(timeout()), SLOT(updateCurrent()));
 
     QMetaObject::invokeMethod(this, "updateTree", Qt::QueuedConnection);
 }
@@ -431,6 +484,7 @@ void FbTreeView::connectPage()
 {
     QWebPage *page = m_view.page();
     connect(page, SIGNAL(contentsChanged()), SLOT(contentsChanged()));
+    connect(page, SIGNAL(structureChanged(QWebElement)), SLOT(structureChanged(QWebElement)));
     connect(page, SIGNAL(selectionChanged()), SLOT(selectionChanged()));
     connect(page->undoStack(), SIGNAL(indexChanged(int)), SLOT(contentsChanged()));
 }
@@ -477,6 +531,9 @@ void FbTreeView::initActions(QToolBar *toolbar)
     connect(act, SIGNAL(triggered()), SLOT(deleteNode()));
     toolbar->addAction(act);
 
+    actionSource = act = new QAction(tr("Show &source"), this);
+    connect(act, SIGNAL(triggered()), SLOT(showSource()));
+
     actionCut = act = new QAction(FbIcon("edit-cut"), tr("Cu&t"), this);
     act->setShortcutContext(Qt::WidgetShortcut);
     act->setPriority(QAction::LowPriority);
@@ -594,6 +651,7 @@ void FbTreeView::contextMenu(const QPoint &pos)
     }
 
     menu.addAction(actionDelete);
+    menu.addAction(actionSource);
     menu.addSeparator();
     menu.addAction(actionCut);
     menu.addAction(actionCopy);
@@ -616,6 +674,51 @@ void FbTreeView::contentsChanged()
     m_timerUpdate.start();
 }
 
+void FbTreeView::structureChanged(const QWebElement &parent)
+{
+    if (FbTreeModel * m = model()) {
+        m->update(parent);
+    }
+}
+
+static int fb2Children(const QWebElement &parent)
+{
+    int count = 0;
+    for (QWebElement child = parent.firstChild(); !child.isNull(); child = child.nextSibling()) count++;
+    return count;
+}
+
+void FbTreeView::updateCurrent()
+{
+    // Typing only touches the block under the caret, structural
+    // changes are reported by the undo commands themselves. Native
+    // edits across sections are caught by the count of top-level
+    // blocks around the caret, their body is reconciled then.
+    FbTreeModel * m = model();
+    if (!m) {
+        updateTree();
+        return;
+    }
+    FbTextElement element = m_view.page()->current();
+    if (element.isNull()) {
+        updateTree();
+        return;
+    }
+
+    QWebElement section = element;
+    while (!section.isNull() && !FbTextElement(section.parent()).isBody()) section = section.parent();
+    if (!section.isNull()) {
+        QWebElement body = section.parent();
+        int siblings = fb2Children(body);
+        if (section != m_section || siblings != m_siblings) {
+            m_section = section;
+            m_siblings = siblings;
+            m->update(body);
+        }
+    }
+    m->update(element);
+}
+
 void FbTreeView::activated(const QModelIndex &index)
 {
     if (qApp->focusWidget() == &m_view) return;
@@ -628,8 +731,10 @@ void FbTreeView::selectTree()
 {
     if (qApp->focusWidget() == this) return;
     if (FbTreeModel * m = model()) {
-        QString location = m->view().page()->location();
-        QModelIndex index = m->index(location);
+        FbTreeItem * item = m->item(m_view.page()->nodeId());
+        if (!item) item = m->find(m_view.page()->current());
+        if (!item) return;
+        QModelIndex index = m->index(item);
         if (!index.isValid()) return;
         setCurrentIndex(index);
         scrollTo(index);
@@ -737,6 +842,19 @@ void FbTreeView::insertDate()
 {
 }
 
+void FbTreeView::showSource()
+{
+    // The code view maps top-level sections only, nested
+    // items are shown at the start of the section holding them
+    FbTreeModel * m = model();
+    FbTreeItem * i = m ? m->item(currentIndex()) : 0;
+    if (!i) return;
+    QWebElement section = i->element();
+    while (!section.isNull() && !FbTextElement(section.parent()).isBody()) section = section.parent();
+    int id = section.isNull() ? 0 : section.attribute("data-node").toInt();
+    emit m_view.showNode(id);
+}
+
 void FbTreeView::deleteNode()
 {
     if (FbTreeModel * m = model()) {
@@ -2,7 +2,9 @@
 #define FB2TREE_H
 
 #include <QAbstractItemModel>
+#include <QHash>
 #include <QMenu>
+#include <QPointer>
 #include <QTreeView>
 #include <QTimer>
 #include <QToolBar>
@@ -76,16 +78,14 @@ public:
         return m_element.geometry().topLeft();
     }
 
-    FbTreeItem * content(int number) const;
-
-    QString selector() const;
-
     QString text() const;
 
+    int id() const;
+
     void init();
 
 private:
-    QString title();
+    static QString title(const QWebElement &element);
 
 private:
     FbTreeList m_list;
@@ -105,12 +105,14 @@ public:
     explicit FbTreeModel(FbTextEdit &view, QObject *parent = 0);
     virtual ~FbTreeModel();
     QModelIndex index(FbTreeItem *item, int column = 0) const;
-    QModelIndex index(const QString &location) const;
     FbTextEdit & view() { return m_view; }
     void selectText(const QModelIndex &index);
     QModelIndex move(const QModelIndex &index, int dx, int dy);
     QModelIndex append(const QModelIndex &parent, FbTextElement element);
     FbTreeItem * item(const QModelIndex &index) const;
+    FbTreeItem * item(int id) const;
+    FbTreeItem * find(const QWebElement &element) const;
+    void update(const QWebElement &element);
     void update();
 
 public:
@@ -123,11 +125,14 @@ public:
     virtual bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex());
 
 private:
-    void update(FbTreeItem &item);
+    void update(FbTreeItem &item, bool deep = true);
+    void attach(FbTreeItem &item);
 
 private:
+    typedef QHash<int, QPointer<FbTreeItem> > FbTreeHash;
     FbTextEdit & m_view;
     FbTreeItem * m_root;
+    FbTreeHash m_ids;
 };
 
 class FbTreeView : public QTreeView
@@ -144,8 +149,10 @@ private slots:
     void activated(const QModelIndex &index);
     void contextMenu(const QPoint &pos);
     void contentsChanged();
+    void structureChanged(const QWebElement &parent);
     void selectionChanged();
     void selectTree();
+    void updateCurrent();
 
     void insertSection();
     void insertTitle();
@@ -157,6 +164,7 @@ private slots:
     void insertDate();
     void insertText();
     void deleteNode();
+    void showSource();
 
     void moveUp();
     void moveDown();
@@ -175,9 +183,12 @@ private:
     FbTextEdit & m_view;
     QTimer m_timerSelect;
     QTimer m_timerUpdate;
+    QWebElement m_section;
+    int m_siblings;
     QAction
         *actionSection,
         *actionDelete,
+        *actionSource,
         *actionTitle,
         *actionAuthor,
         *actionEpigraph,
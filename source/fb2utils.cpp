@@ -4,6 +4,7 @@
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QTextStream>
 
 static QIcon loadIcon(const QString &name)
@@ -19,13 +20,8 @@ FbIcon::FbIcon(const QString &name)
 {
 }
 
-QString jScript(const QString &filename)
+static QString loadScript(const QString &filepath)
 {
-
-    QString filepath = ":/js/" + filename;
-
-    // TODO: throw an exception instead of
-    // returning an empty string
     QFile file( filepath );
     if (!file.open(QFile::ReadOnly)) return QString();
 
@@ -40,3 +36,66 @@ QString jScript(const QString &filename)
 
     return in.readAll();
 }
+
+typedef QHash<QString, QString> FbScriptHash;
+
+static FbScriptHash loadScripts()
+{
+    FbScriptHash hash;
+    QDir dir(":/js/");
+    QStringList filters("*.js");
+    foreach (QString filename, dir.entryList(filters, QDir::Files)) {
+        hash.insert(filename, loadScript(dir.filePath(filename)));
+    }
+    return hash;
+}
+
+static const FbScriptHash & scripts()
+{
+    static const FbScriptHash hash = loadScripts();
+    return hash;
+}
+
+QString jScript(const QString &filename)
+{
+    // TODO: throw an exception instead of
+    // returning an empty string
+    return scripts().value(filename);
+}
+
+QStringList jScriptList()
+{
+    // Scripts defining named functions, evaluated once per page load
+    QStringList list;
+    list << "get_status.js";
+    list << "node_id.js";
+    list << "set_cursor.js";
+    list << "section_get.js";
+    list << "section_new.js";
+    list << "export.js";
+    list << "text_index.js";
+    list << "sync_map.js";
+    list << "outline.js";
+    return list;
+}
+
+QString jString(const QString &text)
+{
+    // Quoted JavaScript string literal
+    QString result;
+    result.reserve(text.length() + 2);
+    result += '"';
+    foreach (QChar c, text) {
+        switch (c.unicode()) {
+            case '"'   : result += "\\\""; break;
+            case '\\'  : result += "\\\\"; break;
+            case '\n'  : result += "\\n"; break;
+            case '\r'  : result += "\\r"; break;
+            case 0x2028: result += "\\u2028"; break;
+            case 0x2029: result += "\\u2029"; break;
+            default    : result += c;
+        }
+    }
+    result += '"';
+    return result;
+}
@@ -3,6 +3,7 @@
 
 #include <QIcon>
 #include <QString>
+#include <QStringList>
 
 #define FB2DELETE(p) { if ((p) != NULL) { delete (p); (p) = NULL; } }
 
@@ -14,4 +15,8 @@ public:
 
 QString jScript(const QString &filename);
 
+QStringList jScriptList();
+
+QString jString(const QString &text);
+
 #endif // FB2UTILS_H
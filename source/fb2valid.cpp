@@ -0,0 +1,289 @@
+#include "fb2valid.hpp"
+
+#include <QAbstractMessageHandler>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QRegExp>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QUrl>
+#include <QXmlSchema>
+#include <QXmlSchemaValidator>
+#include <QtDebug>
+
+#ifdef FB2_USE_LIBXML2
+#include <libxml/xmlreader.h>
+#include <libxml/xmlschemas.h>
+#endif
+
+static QMutex schemaMutex;
+
+#ifdef FB2_USE_LIBXML2
+
+#if LIBXML_VERSION >= 21200
+typedef const xmlError * FbXmlError;
+#else
+typedef xmlErrorPtr FbXmlError;
+#endif
+
+static xmlSchemaPtr fb2Schema()
+{
+    // Compiled once per process from copies of the bundled files,
+    // the main schema imports its companions by relative location.
+    static xmlSchemaPtr schema = 0;
+    static bool loaded = false;
+    static QTemporaryDir dir;
+
+    QMutexLocker locker(&schemaMutex);
+    Q_UNUSED(locker);
+    if (loaded) return schema;
+    loaded = true;
+
+    if (!dir.isValid()) return 0;
+    foreach (const QString &name, QDir(":/fb2").entryList(QStringList("*.xsd"))) {
+        QFile::copy(":/fb2/" + name, dir.path() + "/" + name);
+    }
+
+    QByteArray path = QFile::encodeName(dir.path() + "/FictionBook2.1.xsd");
+    xmlSchemaParserCtxtPtr context = xmlSchemaNewParserCtxt(path.constData());
+    if (!context) return 0;
+    schema = xmlSchemaParse(context);
+    xmlSchemaFreeParserCtxt(context);
+    return schema;
+}
+
+static void fb2SchemaError(void *data, FbXmlError error)
+{
+    QtMsgType type = QtCriticalMsg;
+    if (error->level == XML_ERR_WARNING) type = QtWarningMsg;
+    if (error->level == XML_ERR_FATAL) type = QtFatalMsg;
+    QString msg = QString::fromUtf8(error->message).trimmed();
+    static_cast<FbValidator*>(data)->report(type, error->line, error->int2, msg);
+}
+
+#else // FB2_USE_LIBXML2
+
+//---------------------------------------------------------------------------
+//  FbValidator::MessageHandler
+//---------------------------------------------------------------------------
+
+class FbValidator::MessageHandler : public QAbstractMessageHandler
+{
+public:
+    explicit MessageHandler(FbValidator &owner)
+        : QAbstractMessageHandler(0), m_owner(owner) {}
+
+protected:
+    virtual void handleMessage(QtMsgType type, const QString &description,
+                               const QUrl &identifier, const QSourceLocation &sourceLocation)
+    {
+        Q_UNUSED(identifier);
+        QString msg = QString(description).remove(QRegExp("<[^>]*>")).simplified();
+        m_owner.report(type, sourceLocation.line(), sourceLocation.column(), msg);
+    }
+
+private:
+    FbValidator &m_owner;
+};
+
+#endif // FB2_USE_LIBXML2
+
+//---------------------------------------------------------------------------
+//  FbValidator
+//---------------------------------------------------------------------------
+
+FbValidator * FbValidator::execute(QObject *parent, const QString &xml)
+{
+    FbValidator *thread = new FbValidator(parent, xml);
+    connect(thread, SIGNAL(warning(int,int,QString)), parent, SIGNAL(warning(int,int,QString)));
+    connect(thread, SIGNAL(error(int,int,QString)), parent, SIGNAL(error(int,int,QString)));
+    connect(thread, SIGNAL(fatal(int,int,QString)), parent, SIGNAL(fatal(int,int,QString)));
+    connect(thread, SIGNAL(finished()), parent, SLOT(validated()));
+    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    thread->start();
+    return thread;
+}
+
+FbValidator::FbValidator(QObject *parent, const QString &xml)
+    : QThread(parent)
+    , m_data(xml.toUtf8())
+    , m_cancel(false)
+    , m_errors(0)
+    , m_row(0)
+    , m_col(0)
+{
+}
+
+FbValidator::~FbValidator()
+{
+    cancel();
+    wait();
+}
+
+void FbValidator::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker);
+    m_cancel = true;
+}
+
+bool FbValidator::isCancelled()
+{
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker);
+    return m_cancel;
+}
+
+void FbValidator::report(QtMsgType type, int row, int col, const QString &msg)
+{
+    if (isCancelled()) return;
+    switch (type) {
+        case QtDebugMsg:
+        case QtWarningMsg:
+            emit warning(row, col, msg);
+            return;
+        case QtFatalMsg:
+            emit fatal(row, col, msg);
+            break;
+        default:
+            emit error(row, col, msg);
+    }
+    if (m_errors++ == 0) {
+        m_row = row;
+        m_col = col;
+    }
+}
+
+void FbValidator::run()
+{
+    if (!validate()) {
+        emit error(0, 0, tr("Schema is not valid"));
+        m_errors++;
+    }
+}
+
+#ifdef FB2_USE_LIBXML2
+
+bool FbValidator::validate()
+{
+    xmlSchemaPtr schema = fb2Schema();
+    if (!schema) return false;
+
+    xmlSchemaValidCtxtPtr context = xmlSchemaNewValidCtxt(schema);
+    xmlTextReaderPtr reader = xmlReaderForMemory(m_data.constData(), m_data.size(), 0, "UTF-8", XML_PARSE_NONET);
+    if (context && reader) {
+        // The reader feeds the schema validator node by node,
+        // so every problem is reported and the run can be stopped.
+        xmlSchemaSetValidStructuredErrors(context, fb2SchemaError, this);
+        xmlTextReaderSetStructuredErrorHandler(reader, fb2SchemaError, this);
+        if (xmlTextReaderSchemaValidateCtxt(reader, context, 0) == 0) {
+            while (!isCancelled() && xmlTextReaderRead(reader) == 1) ;
+        }
+    }
+    if (reader) xmlFreeTextReader(reader);
+    if (context) xmlSchemaFreeValidCtxt(context);
+    return true;
+}
+
+#else // FB2_USE_LIBXML2
+
+bool FbValidator::validate()
+{
+    // QtXmlPatterns stops at the first error, the compiled schema
+    // is reused but not shared between concurrent runs.
+    static QXmlSchema *schema = 0;
+    QMutexLocker locker(&schemaMutex);
+    Q_UNUSED(locker);
+    if (!schema) {
+        schema = new QXmlSchema;
+        schema->load(QUrl("qrc:/fb2/FictionBook2.1.xsd"));
+    }
+    if (!schema->isValid()) return false;
+
+    MessageHandler handler(*this);
+    QXmlSchemaValidator validator(*schema);
+    validator.setMessageHandler(&handler);
+    validator.validate(m_data);
+    return true;
+}
+
+#endif // FB2_USE_LIBXML2
+
+//---------------------------------------------------------------------------
+//  FbTextChecker
+//---------------------------------------------------------------------------
+
+void FbTextChecker::execute(QObject *parent, int serial, int root, const QVariantList &outline)
+{
+    FbTextChecker *thread = new FbTextChecker(parent, serial, root, outline);
+    connect(thread, SIGNAL(checked(int,int,QVariantList)), parent, SLOT(checked(int,int,QVariantList)));
+    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    thread->start();
+}
+
+FbTextChecker::FbTextChecker(QObject *parent, int serial, int root, const QVariantList &outline)
+    : QThread(parent)
+    , m_outline(outline)
+    , m_serial(serial)
+    , m_root(root)
+{
+}
+
+static QHash<QString, QRegularExpression> fb2Models()
+{
+    // Content models of FictionBook2.1.xsd over the child names listed
+    // by FbOutline(), p stands for v and empty-line as well.
+    QHash<QString, QString> list;
+    list["section"] = "((title )?(epigraph )*(image )?(annotation )?"
+        "((section )+|(p|poem|subtitle|cite|table) ((p|image|poem|subtitle|cite|table) )*))?";
+    list["poem"] = "(title )?(epigraph )*(stanza )+(text-author )*(date )?";
+    list["stanza"] = "(title )?(subtitle )?(p )+";
+    list["cite"] = "((p|poem|subtitle|table) )*(text-author )*";
+    list["epigraph"] = "((p|poem|cite) )*(text-author )*";
+    list["annotation"] = "((p|poem|cite|subtitle|table) )*";
+    list["title"] = "(p )*";
+
+    QHash<QString, QRegularExpression> result;
+    QHash<QString, QString>::const_iterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        result.insert(it.key(), QRegularExpression("^(?:" + it.value() + ")$"));
+    }
+    return result;
+}
+
+QString FbTextChecker::check(const QString &name, const QString &content)
+{
+    static const QHash<QString, QRegularExpression> models = fb2Models();
+
+    QHash<QString, QRegularExpression>::const_iterator model = models.find(name);
+    if (model == models.constEnd()) return QString();
+    const QRegularExpression &rx = model.value();
+
+    QString text = content.isEmpty() ? QString() : content + ' ';
+    if (rx.match(text).hasMatch()) return QString();
+
+    // The first child that can't continue any valid sequence
+    QStringList children = content.split(' ', QString::SkipEmptyParts);
+    QString prefix;
+    foreach (const QString &child, children) {
+        prefix += child + ' ';
+        QRegularExpressionMatch match = rx.match(prefix, 0, QRegularExpression::PartialPreferCompleteMatch);
+        if (!match.hasMatch() && !match.hasPartialMatch()) {
+            return QObject::tr("<%1> is not allowed at this place in <%2>").arg(child, name);
+        }
+    }
+    return QObject::tr("<%1> is incomplete").arg(name);
+}
+
+void FbTextChecker::run()
+{
+    QVariantList errors;
+    for (int i = 0; i + 2 < m_outline.count(); i += 3) {
+        QString msg = check(m_outline.at(i + 1).toString(), m_outline.at(i + 2).toString());
+        if (msg.isEmpty()) continue;
+        errors << m_outline.at(i) << msg;
+    }
+    emit checked(m_serial, m_root, errors);
+}
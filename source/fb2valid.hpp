@@ -0,0 +1,70 @@
+#ifndef FB2VALID_H
+#define FB2VALID_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QThread>
+#include <QVariant>
+
+class FbValidator : public QThread
+{
+    Q_OBJECT
+
+public:
+    static FbValidator * execute(QObject *parent, const QString &xml);
+    ~FbValidator();
+    void cancel();
+    bool isCancelled();
+    int errors() const { return m_errors; }
+    int row() const { return m_row; }
+    int col() const { return m_col; }
+    void report(QtMsgType type, int row, int col, const QString &msg);
+
+signals:
+    void warning(int row, int col, const QString &msg);
+    void error(int row, int col, const QString &msg);
+    void fatal(int row, int col, const QString &msg);
+
+protected:
+    void run();
+
+private:
+    explicit FbValidator(QObject *parent, const QString &xml);
+    bool validate();
+
+private:
+    class MessageHandler;
+
+private:
+    QByteArray m_data;
+    QMutex m_mutex;
+    bool m_cancel;
+    int m_errors;
+    int m_row;
+    int m_col;
+};
+
+class FbTextChecker : public QThread
+{
+    Q_OBJECT
+
+public:
+    static void execute(QObject *parent, int serial, int root, const QVariantList &outline);
+
+signals:
+    void checked(int serial, int root, const QVariantList &errors);
+
+protected:
+    void run();
+
+private:
+    explicit FbTextChecker(QObject *parent, int serial, int root, const QVariantList &outline);
+    static QString check(const QString &name, const QString &content);
+
+private:
+    QVariantList m_outline;
+    int m_serial;
+    int m_root;
+};
+
+#endif // FB2VALID_H
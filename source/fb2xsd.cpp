@@ -0,0 +1,149 @@
+#include "fb2xsd.hpp"
+
+#include <QDomDocument>
+#include <QFile>
+
+//---------------------------------------------------------------------------
+//  FbSchemeIndex
+//---------------------------------------------------------------------------
+
+const FbSchemeIndex & FbSchemeIndex::instance()
+{
+    static const FbSchemeIndex index;
+    return index;
+}
+
+FbSchemeIndex::FbSchemeIndex()
+    : m_root(-1)
+{
+    // The schema is read once, element declarations and named types
+    // are kept with their children resolved, the DOM is dropped.
+    QDomDocument doc;
+    QFile file(":/fb2/FictionBook2.1.xsd");
+    if (!file.open(QIODevice::ReadOnly) || !doc.setContent(&file)) return;
+
+    QDomElement schema = doc.firstChildElement("xs:schema");
+    QDomElement book;
+    QDomElement child = schema.firstChildElement();
+    while (!child.isNull()) {
+        if (child.tagName() == "xs:complexType") {
+            m_complex.insert(child.attribute("name"), child);
+        } else if (child.tagName() == "xs:element" && child.attribute("name") == "FictionBook") {
+            book = child;
+        }
+        child = child.nextSiblingElement();
+    }
+    if (!book.isNull()) m_root = declare(book);
+    m_complex.clear();
+}
+
+QString FbSchemeIndex::type(const QDomElement &element)
+{
+    QString result = element.attribute("type");
+    if (!result.isEmpty()) return result;
+    QDomElement child = element.firstChildElement("xs:complexType").firstChildElement();
+    while (!child.isNull()) {
+        QString tag = child.tagName();
+        if (tag == "xs:complexContent" || tag == "xs:simpleContent") {
+            return child.firstChildElement("xs:extension").attribute("base");
+        }
+        child = child.nextSiblingElement();
+    }
+    return QString();
+}
+
+QString FbSchemeIndex::info(const QDomElement &element)
+{
+    return element.firstChildElement("xs:annotation").firstChildElement("xs:documentation").text();
+}
+
+int FbSchemeIndex::declare(const QDomElement &element)
+{
+    Node node;
+    node.name = element.attribute("name");
+    node.type = type(element);
+    node.info = info(element);
+    node.minOccurs = element.attribute("minOccurs");
+    node.maxOccurs = element.attribute("maxOccurs");
+    collect(element, node.content);
+    if (!node.type.isEmpty()) node.typed = content(node.type);
+    m_nodes.append(node);
+    return m_nodes.count() - 1;
+}
+
+int FbSchemeIndex::content(const QString &type)
+{
+    // Recursive types refer to the entry registered before it is filled
+    QHash<QString, int>::const_iterator it = m_types.find(type);
+    if (it != m_types.constEnd()) return it.value();
+
+    QDomElement complex = m_complex.value(type);
+    if (complex.isNull()) {
+        m_types.insert(type, -1);
+        return -1;
+    }
+
+    int index = m_contents.count();
+    m_contents.append(Content());
+    m_types.insert(type, index);
+
+    Content result;
+    collect(complex, result);
+    m_contents[index] = result;
+    return index;
+}
+
+void FbSchemeIndex::collect(const QDomElement &parent, Content &content)
+{
+    QDomElement child = parent.firstChildElement();
+    while (!child.isNull()) {
+        QString tag = child.tagName();
+        if (tag == "xs:element") {
+            QString name = child.attribute("name");
+            if (!content.items.contains(name)) content.items.append(name);
+            if (!content.children.contains(name)) content.children.insert(name, declare(child));
+            content.elements = true;
+        } else if (tag == "xs:choice" || tag == "xs:complexType" || tag == "xs:sequence") {
+            collect(child, content);
+        }
+        child = child.nextSiblingElement();
+    }
+}
+
+const FbSchemeIndex::Node * FbSchemeIndex::root() const
+{
+    return m_root < 0 ? 0 : &m_nodes.at(m_root);
+}
+
+const FbSchemeIndex::Node * FbSchemeIndex::child(const Node *parent, const QString &name) const
+{
+    if (!parent) parent = root();
+    if (!parent) return 0;
+
+    QHash<QString, int>::const_iterator it = parent->content.children.find(name);
+    if (it != parent->content.children.constEnd()) return &m_nodes.at(it.value());
+
+    if (parent->typed < 0) return 0;
+    const Content &content = m_contents.at(parent->typed);
+    it = content.children.find(name);
+    if (it != content.children.constEnd()) return &m_nodes.at(it.value());
+
+    return 0;
+}
+
+QStringList FbSchemeIndex::items(const Node *node) const
+{
+    if (!node) return QStringList();
+    if (node->type.isEmpty()) return node->content.items;
+    if (node->typed < 0) return QStringList();
+    return m_contents.at(node->typed).items;
+}
+
+bool FbSchemeIndex::canEdit(const Node *node) const
+{
+    if (!node) return true;
+    if (node->type == "sequenceType") return true;
+    if (node->type.isEmpty()) return !node->content.elements;
+    if (node->typed < 0) return true;
+    return !m_contents.at(node->typed).elements;
+}
@@ -0,0 +1,58 @@
+#ifndef FB2XSD_H
+#define FB2XSD_H
+
+#include <QDomElement>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class FbSchemeIndex
+{
+public:
+    class Content
+    {
+    public:
+        Content() : elements(false) {}
+        QStringList items;
+        QHash<QString, int> children;
+        bool elements;
+    };
+
+    class Node
+    {
+    public:
+        Node() : typed(-1) {}
+        QString name;
+        QString type;
+        QString info;
+        QString minOccurs;
+        QString maxOccurs;
+        Content content;
+        int typed;
+    };
+
+public:
+    static const FbSchemeIndex & instance();
+    const Node * root() const;
+    const Node * child(const Node *parent, const QString &name) const;
+    QStringList items(const Node *node) const;
+    bool canEdit(const Node *node) const;
+
+private:
+    FbSchemeIndex();
+    static QString type(const QDomElement &element);
+    static QString info(const QDomElement &element);
+    int declare(const QDomElement &element);
+    int content(const QString &type);
+    void collect(const QDomElement &parent, Content &content);
+
+private:
+    QVector<Node> m_nodes;
+    QVector<Content> m_contents;
+    QHash<QString, int> m_types;
+    QHash<QString, QDomElement> m_complex;
+    int m_root;
+};
+
+#endif // FB2XSD_H
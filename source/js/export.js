@@ -1,4 +1,4 @@
-(function(root) {
+function FbExport(root, skip) {
     var selection = document.getSelection();
     var anchorNode = selection.anchorNode;
     var focusNode = selection.focusNode;
@@ -9,6 +9,10 @@
             if (focusNode === node) handler.onFocus(selection.focusOffset);
         } else if (node.nodeName === "#comment") {
             handler.onCom(node.data);
+        } else if (node.nodeName === "DIV" && node.hasAttribute("data-fragment")) {
+            handler.onFragment(parseInt(node.getAttribute("data-fragment")));
+        } else if (skip && node.nodeName === "FB:SECTION" && skip[node.getAttribute("data-node")]) {
+            handler.onSkip(parseInt(node.getAttribute("data-node")));
         } else {
             var atts = node.attributes;
             var count = atts.length;
@@ -21,4 +25,4 @@
     handler.onNew(root.nodeName);
     for (var n = root.firstChild; n !== null; n = n.nextSibling) f(n);
     handler.onEnd(root.nodeName);
-})(document);
+}
@@ -0,0 +1,74 @@
+var FbFix = (function(){
+var observer = null, counts = null;
+var strip = function(node) {
+ if (node.hasAttribute("style") && !node.hasAttribute("data-fragment")) node.removeAttribute("style");
+};
+var census = function() {
+ // Ids of the document are counted once per batch of mutations
+ counts = {};
+ var list = document.querySelectorAll("[data-node]");
+ for (var i = 0; i < list.length; i++) {
+  var id = list[i].getAttribute("data-node");
+  counts[id] = (counts[id] || 0) + 1;
+ }
+};
+var renumber = function(node) {
+ // A copy pasted within the document keeps the ids of the original
+ if (counts === null) census();
+ var id = node.getAttribute("data-node");
+ if (!(counts[id] > 1)) return;
+ counts[id]--;
+ var fresh = fragments.newNode();
+ if (fresh) node.setAttribute("data-node", fresh); else node.removeAttribute("data-node");
+ if (fresh) counts[fresh] = 1;
+};
+var clean = function(node) {
+ if (node.nodeType !== 1) return;
+ strip(node);
+ var list = node.querySelectorAll("[style]:not([data-fragment])");
+ for (var i = 0; i < list.length; i++) list[i].removeAttribute("style");
+ if (node.hasAttribute("data-node")) renumber(node);
+ list = node.querySelectorAll("[data-node]");
+ for (var i = 0; i < list.length; i++) renumber(list[i]);
+};
+var handle = function(records) {
+ counts = null;
+ for (var i = 0; i < records.length; i++) {
+  var record = records[i];
+  if (record.type === "attributes") {
+   strip(record.target);
+  } else {
+   var nodes = record.addedNodes;
+   for (var j = 0; j < nodes.length; j++) clean(nodes[j]);
+  }
+ }
+};
+return {
+ start: function() {
+  var Observer = window.MutationObserver || window.WebKitMutationObserver;
+  if (Observer === undefined) return false;
+  if (observer === null) observer = new Observer(handle);
+  observer.observe(document.body, {childList: true, subtree: true, attributes: true, attributeFilter: ["style"]});
+  return true;
+ },
+ quiet: function(change) {
+  // Markup the page restores itself, like folded sections, is trusted
+  if (observer) handle(observer.takeRecords());
+  change();
+  if (observer) observer.takeRecords();
+ },
+ caret: function() {
+  var node = document.getSelection().anchorNode;
+  while (node && node.nodeType !== 1) node = node.parentNode;
+  while (node && node.tagName !== "P" && node.parentNode !== document.body) node = node.parentNode;
+  if (!node) return false;
+  counts = null;
+  clean(node.parentNode || node);
+  return true;
+ },
+ all: function() {
+  counts = null;
+  clean(document.body);
+ }
+};
+})();
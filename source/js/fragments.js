@@ -0,0 +1,123 @@
+var FbVirtual = (function(){
+var near = 1, far = 3, timer = null, live = [], observer = null;
+var changed = {}, outside = false;
+var section = function(node) {
+ while (node && node.parentNode) {
+  var parent = node.parentNode;
+  if (parent.tagName === "FB:BODY" && node.tagName === "FB:SECTION") return node;
+  node = parent;
+ }
+ return null;
+};
+var expand = function(div) {
+ if (observer) watch(observer.takeRecords());
+ var parent = div.parentNode;
+ var keep = 0;
+ for (var n = parent.firstElementChild; n !== div; n = n.nextElementSibling) keep++;
+ var index = div.getAttribute("data-fragment");
+ FbFix.quiet(function() {
+  div.insertAdjacentHTML("beforebegin", fragments.html(parseInt(index)));
+  parent.removeChild(div);
+ });
+ if (observer) observer.takeRecords();
+ parent.fbFragment = index;
+ parent.fbKeep = keep;
+ parent.fbDirty = false;
+ if (observer) live.push(parent);
+ fragments.changed(location(parent));
+};
+var collapse = function(parent) {
+ var first = parent.children[parent.fbKeep];
+ if (!first) return;
+ if (observer) watch(observer.takeRecords());
+ var height = parent.getBoundingClientRect().bottom - first.getBoundingClientRect().top;
+ var div = document.createElement("div");
+ div.setAttribute("data-fragment", parent.fbFragment);
+ div.setAttribute("style", "height:" + Math.round(height) + "px");
+ FbFix.quiet(function() {
+  while (first.nextSibling) parent.removeChild(first.nextSibling);
+  parent.replaceChild(div, first);
+ });
+ if (observer) observer.takeRecords();
+ fragments.changed(location(parent));
+};
+var update = function() {
+ timer = null;
+ var height = window.innerHeight;
+ var list = document.querySelectorAll("div[data-fragment]");
+ for (var i = 0; i < list.length; i++) {
+  var rect = list[i].getBoundingClientRect();
+  if (rect.bottom > -height * near && rect.top < height * (1 + near)) {
+   expand(list[i]);
+  }
+ }
+ var keep = [];
+ for (var i = 0; i < live.length; i++) {
+  var node = live[i];
+  if (node.fbDirty || !node.parentNode) continue;
+  var rect = node.getBoundingClientRect();
+  if (rect.bottom < -height * far || rect.top > height * (1 + far)) {
+   collapse(node);
+  } else {
+   keep.push(node);
+  }
+ }
+ live = keep;
+ if (observer) observer.takeRecords();
+};
+var ignored = function(record) {
+ // Attributes that are never saved: the editor's own marks,
+ // inline styles and the pictures loaded or dropped on scroll
+ if (record.type !== "attributes") return false;
+ var name = record.attributeName;
+ if (name === "style") return true;
+ if (name.indexOf("data-") === 0 && name !== "data-src") return true;
+ return record.target.tagName === "IMG" && (name === "src" || name === "width" || name === "height");
+};
+var watch = function(records) {
+ for (var i = 0; i < records.length; i++) {
+  if (ignored(records[i])) continue;
+  var node = section(records[i].target);
+  if (node) {
+   node.fbDirty = true;
+   changed[node.hasAttribute("data-node") ? node.getAttribute("data-node") : -1] = true;
+  } else {
+   outside = true;
+  }
+ }
+};
+var schedule = function() {
+ if (timer === null) timer = setTimeout(update, 100);
+};
+window.addEventListener("scroll", schedule, false);
+window.addEventListener("resize", schedule, false);
+return {
+ start: function() {
+  // Sections are folded back only while edits to them can be tracked
+  var Observer = window.MutationObserver || window.WebKitMutationObserver;
+  if (Observer !== undefined && observer === null) {
+   observer = new Observer(watch);
+   observer.observe(document.body, {childList: true, subtree: true, characterData: true, attributes: true});
+  }
+  update();
+ },
+ expand: function(index) {
+  var div = document.querySelector("div[data-fragment='" + index + "']");
+  if (!div) return;
+  expand(div);
+  if (observer) observer.takeRecords();
+ },
+ changes: function() {
+  // Ids of top-level sections edited since the last call, 0 stands
+  // for edits outside of them and -1 for edits that can't be placed
+  if (observer === null) return [-1];
+  watch(observer.takeRecords());
+  var result = [];
+  for (var id in changed) result.push(parseInt(id));
+  if (outside) result.push(0);
+  changed = {};
+  outside = false;
+  return result;
+ }
+};
+})();
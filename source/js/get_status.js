@@ -1,9 +1,19 @@
-var baseNode = document.getSelection().baseNode;
-if (baseNode === null) ''; else {
-	(f = function(node){
-		var tag = node.tagName;
-		if (tag === 'BODY') return '';
-		if (tag === 'DIV') tag = node.getAttribute('CLASS');
-		return f(node.parentNode) + '/' + tag;
-	})(baseNode.parentNode);
-}
+var FbStatus = (function(){
+var cache = null, text = '';
+var path = function(node) {
+	var tag = node.tagName;
+	if (tag === 'BODY') return '';
+	if (tag === 'DIV') tag = node.getAttribute('CLASS');
+	return path(node.parentNode) + '/' + tag.replace(/^FB:/, '');
+};
+return function(reset) {
+	var baseNode = document.getSelection().baseNode;
+	if (baseNode === null) return '';
+	var node = baseNode.parentNode;
+	if (reset || node !== cache) {
+		cache = node;
+		text = path(node);
+	}
+	return text;
+};
+})();
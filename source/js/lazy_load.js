@@ -0,0 +1,29 @@
+(function(){
+var near = 1, far = 3, timer = null;
+var update = function() {
+ timer = null;
+ var height = window.innerHeight;
+ var images = document.querySelectorAll("img[data-src]");
+ for (var i = 0; i < images.length; i++) {
+  var img = images[i];
+  var rect = img.getBoundingClientRect();
+  if (rect.bottom > -height * near && rect.top < height * (1 + near)) {
+   if (img.hasAttribute("src")) continue;
+   img.removeAttribute("width");
+   img.removeAttribute("height");
+   img.setAttribute("src", img.getAttribute("data-src"));
+  } else if (rect.bottom < -height * far || rect.top > height * (1 + far)) {
+   if (!img.hasAttribute("src") || !img.complete || !img.width) continue;
+   img.setAttribute("width", img.width);
+   img.setAttribute("height", img.height);
+   img.removeAttribute("src");
+  }
+ }
+};
+var schedule = function() {
+ if (timer === null) timer = setTimeout(update, 100);
+};
+window.addEventListener("scroll", schedule, false);
+window.addEventListener("resize", schedule, false);
+window.addEventListener("load", update, false);
+})();
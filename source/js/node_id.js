@@ -0,0 +1,4 @@
+function FbNodeId(node) {
+	while (node && !(node.nodeType === 1 && node.hasAttribute("data-node"))) node = node.parentNode;
+	return node ? parseInt(node.getAttribute("data-node")) : 0;
+}
@@ -0,0 +1,47 @@
+function FbOutline(id) {
+	// Flat (node, name, children) triples of the node and its descendants,
+	// children are the names of block elements separated by spaces.
+	var root = document.querySelector("[data-node='" + id + "']");
+	var result = [];
+	var name = function(node) {
+		if (node.tagName === "P") return node.getAttribute("fb:class") || "p";
+		if (node.tagName === "IMG") return "image";
+		if (node.tagName === "TABLE") return "table";
+		if (node.tagName.substr(0, 3) === "FB:") return node.tagName.substr(3).toLowerCase();
+		return null;
+	};
+	var ident = function(node) {
+		// Elements inserted in the editor get an id to carry the marker,
+		// failing that the violation goes to the nearest marked ancestor
+		if (!node.hasAttribute("data-node")) {
+			var fresh = fragments.newNode();
+			if (fresh) node.setAttribute("data-node", fresh);
+		}
+		return FbNodeId(node);
+	};
+	var walk = function(node) {
+		var list = [];
+		for (var child = node.firstElementChild; child; child = child.nextElementSibling) {
+			if (child.hasAttribute("data-fragment")) return;
+			var tag = name(child);
+			if (tag === null) continue;
+			list.push(tag);
+			if (tag !== "p" && tag !== "subtitle" && tag !== "text-author") walk(child);
+		}
+		result.push(ident(node), name(node), list.join(" "));
+	};
+	if (root) walk(root);
+	return result;
+}
+function FbMarkInvalid(id, list) {
+	// Replaces the markers within the node by the (node, message) pairs
+	var root = document.querySelector("[data-node='" + id + "']");
+	if (!root) return;
+	var old = root.querySelectorAll("[data-invalid]");
+	for (var i = 0; i < old.length; i++) old[i].removeAttribute("data-invalid");
+	root.removeAttribute("data-invalid");
+	for (var i = 0; i + 1 < list.length; i += 2) {
+		var node = list[i] === id ? root : root.querySelector("[data-node='" + list[i] + "']");
+		if (node) node.setAttribute("data-invalid", list[i + 1]);
+	}
+}
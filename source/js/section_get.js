@@ -1,4 +1,4 @@
-(f=function(){
+function FbSectionGet(){
 var selection=window.getSelection();
 if(selection.rangeCount===0)return;
 var range=selection.getRangeAt(0);
@@ -7,9 +7,9 @@ var start=range.startContainer;
 var end=range.endContainer;
 while (true) {
  if(root===null)return;
- tag=root.tagName;
+ var tag=root.tagName;
  if(tag==="BODY")return;
- if(tag==="FB:BODY"||type==="FB:SECTION")break;
+ if(tag==="FB:BODY"||tag==="FB:SECTION")break;
  root = root.parentNode;
 }
 while(start.parentNode!==root) {
@@ -27,4 +27,4 @@ return location(root)
 +","+range.startOffset
 +","+locator(range.endContainer)
 +","+range.endOffset;
-})()
+}
@@ -1,4 +1,4 @@
-f=function(elem,tag,start,end){
+function FbSectionNew(elem,tag,start,end){
 start=$(elem).children().get(start);
 end=$(elem).children().get(end);
 var range=document.createRange();
@@ -11,4 +11,4 @@ range.setEndBefore(start);
 var selection=window.getSelection();
 selection.removeAllRanges();
 selection.addRange(range);
-};
+}
@@ -1,9 +1,10 @@
-window.scrollTo(0,this.offsetTop);
+function FbSetCursor(elem) {
+window.scrollTo(0,elem.offsetTop);
 var range = document.createRange();
-range.setStart(this,0);
-range.setEnd(this,0);
+range.setStart(elem,0);
+range.setEnd(elem,0);
 var selection = window.getSelection();
 selection.removeAllRanges();
 selection.addRange(range);
 range.collapse(true);
-range.select();
+}
@@ -0,0 +1,11 @@
+function FbSectionIds() {
+	// Ids of top-level sections of all bodies in document order
+	var result = [];
+	for (var body = document.body.firstElementChild; body; body = body.nextElementSibling) {
+		if (body.tagName !== "FB:BODY") continue;
+		for (var node = body.firstElementChild; node; node = node.nextElementSibling) {
+			if (node.tagName === "FB:SECTION") result.push(FbIndexId(node, 0));
+		}
+	}
+	return result;
+}
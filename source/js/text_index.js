@@ -0,0 +1,142 @@
+function FbIndexId(node, id) {
+	return node.hasAttribute("data-node") ? parseInt(node.getAttribute("data-node")) : id;
+}
+function FbIndexMark(node) {
+	return node.tagName === "FB:BODY" || node.tagName === "FB:SECTION" || node.tagName === "IMG";
+}
+function FbIndex(root) {
+	// Flat (root, node, fragment, text) quadruples in document order,
+	// bodies, sections and images are marked by fragment -2 and the tag.
+	var result = [];
+	var walk = function(parent, top, id) {
+		for (var node = parent.firstElementChild; node; node = node.nextElementSibling) {
+			if (node.tagName === "P") {
+				result.push(top, id, -1, node.textContent);
+				var images = node.getElementsByTagName("IMG");
+				for (var i = 0; i < images.length; i++) result.push(top, id, -2, "img");
+			} else if (node.hasAttribute("data-fragment")) {
+				result.push(top, id, parseInt(node.getAttribute("data-fragment")), "");
+			} else if (node.tagName !== "FB:DESCRIPTION") {
+				var child = FbIndexId(node, id);
+				var owner = top;
+				if (node.tagName === "FB:BODY") owner = child;
+				if (node.tagName === "FB:SECTION" && parent.tagName === "FB:BODY") owner = child;
+				if (FbIndexMark(node)) result.push(owner, child, -2, node.tagName.toLowerCase());
+				walk(node, owner, child);
+			}
+		}
+	};
+	var id = FbIndexId(root, 0);
+	if (FbIndexMark(root)) result.push(id, id, -2, root.tagName.toLowerCase());
+	walk(root, id, id);
+	return result;
+}
+function FbIndexRoot(node) {
+	// Id of the top-level section holding the node, -1 for the whole document
+	while (node && node.parentNode) {
+		var parent = node.parentNode;
+		if (node.nodeType === 1) {
+			if (node.tagName === "FB:DESCRIPTION") return 0;
+			if (parent.tagName === "FB:BODY") {
+				return node.tagName === "FB:SECTION" ? FbIndexId(node, -1) : -1;
+			}
+		}
+		node = parent;
+	}
+	return -1;
+}
+function FbParagraphs(id) {
+	// Paragraphs numbered within the node, as listed by FbIndex()
+	var root = document.querySelector("[data-node='" + id + "']");
+	var result = [];
+	var walk = function(parent) {
+		for (var node = parent.firstElementChild; node; node = node.nextElementSibling) {
+			if (node.tagName === "P") {
+				result.push(node);
+			} else if (!node.hasAttribute("data-node") && node.tagName !== "FB:DESCRIPTION") {
+				walk(node);
+			}
+		}
+	};
+	if (root) walk(root);
+	return result;
+}
+function FbTextNodes(parent) {
+	var result = [];
+	var walker = document.createTreeWalker(parent, NodeFilter.SHOW_TEXT, null, false);
+	var text;
+	while ((text = walker.nextNode())) result.push(text);
+	return result;
+}
+function FbTextRange(nodes, pos, len) {
+	var range = document.createRange();
+	var offset = 0, start = false;
+	for (var i = 0; i < nodes.length; i++) {
+		var size = nodes[i].nodeValue.length;
+		if (!start && pos <= offset + size) {
+			range.setStart(nodes[i], pos - offset);
+			start = true;
+		}
+		if (start && pos + len <= offset + size) {
+			range.setEnd(nodes[i], pos + len - offset);
+			return range;
+		}
+		offset += size;
+	}
+	return null;
+}
+function FbSelectText(id, number, pos, len) {
+	var target = FbParagraphs(id)[number];
+	if (!target) return false;
+	var range = FbTextRange(FbTextNodes(target), pos, len);
+	if (!range) {
+		range = document.createRange();
+		range.selectNodeContents(target);
+	}
+	target.scrollIntoView();
+	var selection = window.getSelection();
+	selection.removeAllRanges();
+	selection.addRange(range);
+	return true;
+}
+function FbReplaceText(list) {
+	// The list holds (node, number, pos, len, text) matches ordered by
+	// paragraph and position; each changed paragraph is returned as
+	// (node, number, old markup, new markup) for the undo command.
+	var result = [], cache = {};
+	var i = 0;
+	while (i < list.length) {
+		var id = list[i], number = list[i + 1];
+		var j = i;
+		while (j < list.length && list[j] === id && list[j + 1] === number) j += 5;
+		if (!cache[id]) cache[id] = FbParagraphs(id);
+		var target = cache[id][number];
+		if (target) {
+			var before = target.innerHTML;
+			var nodes = FbTextNodes(target);
+			for (var k = j - 5; k >= i; k -= 5) {
+				var range = FbTextRange(nodes, list[k + 2], list[k + 3]);
+				if (!range) continue;
+				if (range.startContainer === range.endContainer) {
+					range.startContainer.replaceData(range.startOffset, range.endOffset - range.startOffset, list[k + 4]);
+				} else {
+					var start = range.startContainer, offset = range.startOffset;
+					range.deleteContents();
+					start.insertData(offset, list[k + 4]);
+				}
+			}
+			result.push(id, number, before, target.innerHTML);
+		}
+		i = j;
+	}
+	return result;
+}
+function FbSetParagraphs(list, column) {
+	var cache = {};
+	for (var i = 0; i + 3 < list.length; i += 4) {
+		var id = list[i];
+		if (!cache[id]) cache[id] = FbParagraphs(id);
+		var target = cache[id][list[i + 1]];
+		if (target) target.innerHTML = list[i + column];
+	}
+}